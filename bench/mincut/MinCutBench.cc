@@ -0,0 +1,111 @@
+/* Replays min-cut instances dumped by MitigatePass (-clou-dump-min-cut=<dir>) and times each max-flow backend, both
+ * on the full greedy algorithm and on independent per-ST max-flow solves.
+ *
+ *   MinCutBench [benchmark flags] <instance-file-or-dir>... [-- clou flags]
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "clou/MinCutInstance.h"
+#include "clou/MinCutGreedy.h"
+#include "clou/FordFulkerson.h"
+
+namespace clou {
+  // Normally provided by the llsct-llvm driver.
+  float Timeout = 0;
+}
+
+namespace {
+
+  using namespace clou;
+
+  std::vector<MinCutInstance> instances;
+
+  void load(const std::filesystem::path& path) {
+    if (std::filesystem::is_directory(path)) {
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+	if (entry.is_regular_file() && entry.path().extension() == ".mincut")
+	  load(entry.path());
+      return;
+    }
+    std::ifstream f(path);
+    if (auto I = MinCutInstance::read(f)) {
+      I->name = path.stem().string();
+      instances.push_back(std::move(*I));
+    } else {
+      llvm::errs() << "MinCutBench: malformed instance: " << path.string() << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  void BM_Greedy(benchmark::State& state, const MinCutInstance *I, MaxFlowAlgorithm algorithm) {
+    max_flow_algorithm = algorithm;
+    size_t cut_size = 0;
+    for (auto _ : state) {
+      MinCutGreedy<unsigned> A;
+      for (const CSRGraph::Edge& e : I->edges)
+	A.G[e.src][e.dst] = e.w;
+      for (const auto& st : I->sts)
+	A.add_st_list(st);
+      A.run();
+      cut_size = A.cut_edges.size();
+    }
+    state.counters["nodes"] = I->nodes;
+    state.counters["edges"] = I->edges.size();
+    state.counters["sts"] = I->sts.size();
+    state.counters["cut"] = cut_size;
+  }
+
+  void BM_MaxFlow(benchmark::State& state, const MinCutInstance *I, MaxFlowAlgorithm algorithm) {
+    const CSRGraph G(I->nodes, I->edges);
+    for (auto _ : state)
+      for (const auto& st : I->sts)
+	benchmark::DoNotOptimize(ford_fulkerson_multi(G, st, algorithm));
+    state.counters["nodes"] = I->nodes;
+    state.counters["edges"] = I->edges.size();
+    state.counters["sts"] = I->sts.size();
+  }
+
+}
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+
+  // Everything after "--" goes to the clou options (e.g., -clou-min-cut-condense=false).
+  std::vector<char *> clou_argv = {argv[0]};
+  int i;
+  for (i = 1; i < argc && std::string(argv[i]) != "--"; ++i)
+    load(argv[i]);
+  for (++i; i < argc; ++i)
+    clou_argv.push_back(argv[i]);
+  llvm::cl::ParseCommandLineOptions(clou_argv.size(), clou_argv.data());
+
+  if (instances.empty()) {
+    llvm::errs() << "usage: " << argv[0] << " [benchmark flags] <instance-file-or-dir>... [-- clou flags]\n";
+    return EXIT_FAILURE;
+  }
+
+  const std::pair<const char *, MaxFlowAlgorithm> algorithms[] = {
+    {"ford-fulkerson", MaxFlowAlgorithm::FordFulkerson},
+    {"dinic", MaxFlowAlgorithm::Dinic},
+  };
+  for (const MinCutInstance& I : instances) {
+    for (const auto& [name, algorithm] : algorithms) {
+      benchmark::RegisterBenchmark(("greedy/" + std::string(name) + "/" + I.name).c_str(), BM_Greedy, &I, algorithm)
+	->Unit(benchmark::kMillisecond);
+      benchmark::RegisterBenchmark(("max_flow/" + std::string(name) + "/" + I.name).c_str(), BM_MaxFlow, &I, algorithm)
+	->Unit(benchmark::kMillisecond);
+    }
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
@@ -0,0 +1,176 @@
+#include "clou/CutCache.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/DenseMap.h>
+
+namespace clou {
+
+  std::string cut_cache_dir;
+  static llvm::cl::opt<std::string, true> cut_cache_dir_flag {
+    "clou-cut-cache-dir",
+    llvm::cl::desc("Directory in which to cache each function's min cut across compilations"),
+    llvm::cl::location(cut_cache_dir),
+  };
+
+  // Bump whenever the cached format, or what the cut depends on, changes.
+  static constexpr const char *cut_cache_version = "clou-cut-cache 2";
+
+#ifndef CLOU_BUILD_ID
+# define CLOU_BUILD_ID "unknown"
+#endif
+
+  namespace {
+
+    // Removes debug locations, which only affect the logs.
+    std::string stripDebugLocs(llvm::StringRef s) {
+      std::string out;
+      out.reserve(s.size());
+      while (!s.empty()) {
+	const size_t i = s.find(", !dbg !");
+	const size_t j = s.find(" !dbg !");
+	const size_t k = std::min(i, j);
+	out += s.take_front(k);
+	if (k == llvm::StringRef::npos)
+	  break;
+	s = s.drop_front(k == i ? 8 : 7);
+	s = s.drop_while([] (char c) { return std::isdigit(c); });
+      }
+      return out;
+    }
+
+    // Renumbers !N and #N in order of first appearance.
+    std::string renumber(llvm::StringRef s) {
+      std::string out;
+      out.reserve(s.size());
+      std::map<std::string, unsigned> ids[2];
+      while (!s.empty()) {
+	const char c = s.front();
+	s = s.drop_front();
+	out += c;
+	if ((c == '!' || c == '#') && !s.empty() && std::isdigit(s.front())) {
+	  const llvm::StringRef num = s.take_while([] (char c) { return std::isdigit(c); });
+	  s = s.drop_front(num.size());
+	  auto& map = ids[c == '#'];
+	  out += std::to_string(map.emplace(num.str(), map.size()).first->second);
+	}
+      }
+      return out;
+    }
+
+    std::string getPath(llvm::StringRef key) {
+      return cut_cache_dir + "/" + key.str() + ".cut";
+    }
+
+  }
+
+  std::string getCutCacheKey(const llvm::Function& F, llvm::StringRef options) {
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    os << cut_cache_version << "\n" << "build " << CLOU_BUILD_ID << "\n" << options << "\n";
+    F.print(os);
+
+    // Things F's text only refers to by number or name.
+    const llvm::Module *M = F.getParent();
+    for (const llvm::Instruction& I : llvm::instructions(F)) {
+      llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>> MDs;
+      I.getAllMetadataOtherThanDebugLoc(MDs);
+      for (const auto& [kind, MD] : MDs)
+	MD->printTree(os, M);
+      if (const auto *C = llvm::dyn_cast<llvm::CallBase>(&I))
+	os << C->getAttributes().getAsString(llvm::AttributeList::FunctionIndex) << "\n";
+      for (const llvm::Value *V : I.operand_values()) {
+	if (const auto *G = llvm::dyn_cast<llvm::GlobalValue>(V)) {
+	  os << G->getName() << " " << G->getLinkage() << " " << G->isDeclaration() << " ";
+	  G->getValueType()->print(os);
+	  if (const auto *CalledF = llvm::dyn_cast<llvm::Function>(G))
+	    os << " " << CalledF->getAttributes().getAsString(llvm::AttributeList::FunctionIndex);
+	  os << "\n";
+	}
+      }
+    }
+    os << F.getAttributes().getAsString(llvm::AttributeList::FunctionIndex) << "\n";
+    os.flush();
+
+    llvm::SHA1 hash;
+    hash.update(renumber(stripDebugLocs(s)));
+    return llvm::toHex(hash.final(), /*LowerCase*/ true);
+  }
+
+  /* The cut is stored as pairs of instruction indices, in instruction order; since the key covers F's IR, the indices
+   * still name the same instructions on a hit.
+   */
+  std::optional<std::vector<CutCacheEdge>> loadCutCache(llvm::Function& F, llvm::StringRef key) {
+    std::ifstream f(getPath(key));
+    if (!f)
+      return std::nullopt;
+    std::string header;
+    if (!std::getline(f, header) || header != cut_cache_version)
+      return std::nullopt;
+
+    std::vector<llvm::Instruction *> insts;
+    for (llvm::Instruction& I : llvm::instructions(F))
+      insts.push_back(&I);
+
+    std::vector<CutCacheEdge> cut;
+    unsigned src, dst;
+    while (f >> src >> dst) {
+      if (src >= insts.size() || dst >= insts.size()) {
+	llvm::WithColor::warning() << "ignoring corrupt min-cut cache entry " << getPath(key) << "\n";
+	return std::nullopt;
+      }
+      cut.emplace_back(insts[src], insts[dst]);
+    }
+    if (!f.eof())
+      return std::nullopt;
+    return cut;
+  }
+
+  void saveCutCache(const llvm::Function& F, llvm::StringRef key, llvm::ArrayRef<CutCacheEdge> cut) {
+    if (::mkdir(cut_cache_dir.c_str(), 0770) < 0 && errno != EEXIST) {
+      llvm::WithColor::warning() << "mkdir: " << cut_cache_dir << ": " << std::strerror(errno) << "\n";
+      return;
+    }
+
+    llvm::DenseMap<const llvm::Instruction *, unsigned> idxs;
+    for (const llvm::Instruction& I : llvm::instructions(F))
+      idxs.try_emplace(&I, idxs.size());
+
+    // Write to a temporary file and rename it into place, since parallel builds may race on the same entry.
+    const std::string path = getPath(key);
+    const std::string tmp_path = path + "." + std::to_string(::getpid()) + ".tmp";
+    {
+      std::ofstream f(tmp_path);
+      f << cut_cache_version << "\n";
+      for (const auto& [src, dst] : cut)
+	f << idxs.lookup(src) << " " << idxs.lookup(dst) << "\n";
+      if (!f) {
+	llvm::WithColor::warning() << "failed to write min-cut cache entry " << tmp_path << "\n";
+	std::remove(tmp_path.c_str());
+	return;
+      }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) < 0) {
+      llvm::WithColor::warning() << "rename: " << path << ": " << std::strerror(errno) << "\n";
+      std::remove(tmp_path.c_str());
+    }
+  }
+
+}
@@ -1,1013 +1,645 @@
 #include "clou/FordFulkerson.h"
 
 #include <cassert>
+#include <algorithm>
 #include <queue>
 #include <stack>
 #include <numeric>
-#include <sstream>
-#include <fstream>
+#include <limits>
+#include <cstdint>
 
 #include <llvm/ADT/BitVector.h>
-#include <llvm/Support/raw_ostream.h>
-#include <llvm/ADT/Hashing.h>
-#include <llvm/Support/WithColor.h>
-#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
 
 namespace clou {
 
-  class Graph {
-  public:
-    using Node = unsigned;
-    using Weight = unsigned;
-    using Dsts = std::map<Node, Weight>;
-    virtual Weight get_weight(Node src, Node dst) const = 0; // Returns 0 if no edge exists.
-    virtual unsigned nodes() const = 0;
+  MaxFlowAlgorithm max_flow_algorithm;
+  static llvm::cl::opt<MaxFlowAlgorithm, true> max_flow_algorithm_flag {
+    "clou-max-flow",
+    llvm::cl::desc("Max-flow algorithm used to compute min cuts"),
+    llvm::cl::location(max_flow_algorithm),
+    llvm::cl::init(MaxFlowAlgorithm::FordFulkerson),
+    llvm::cl::values(clEnumValN(MaxFlowAlgorithm::FordFulkerson, "ford-fulkerson", "One augmenting path per search"),
+		     clEnumValN(MaxFlowAlgorithm::Dinic, "dinic", "Blocking flows on BFS level graphs")),
   };
 
-  class ImmutableGraph : public Graph {};
+  using Node = CSRGraph::Node;
+  using Weight = CSRGraph::Weight;
 
-  class MutableGraph : public Graph {
-  public:
-    virtual void put_weight(Node src, Node dst, Weight w) = 0;
+  static llvm::cl::opt<bool> prune_flow_networks {
+    "clou-max-flow-prune",
+    llvm::cl::desc("Build each ST's flow network only on the nodes that lie on some source-sink path"),
+    llvm::cl::init(true),
   };
 
-  class ImmutableVectorGraph final : public ImmutableGraph {
-  public:
-    ImmutableVectorGraph(const std::vector<Dsts> *G): G(*G) {}
-
-    using iterator = Dsts::const_iterator;
-    using range_type = llvm::iterator_range<iterator>;
-    range_type operator[](Node src) const {
-      return range_type(G.at(src));
-    }
-
-    range_type empty_range() const {
-      static Dsts dummy;
-      return range_type(dummy);
-    }
-    
-    Weight get_weight(Node src, Node dst) const override {
-      const auto& dsts = G.at(src);
-      const auto it = dsts.find(dst);
-      if (it == dsts.end())
-	return 0;
-      else
-	return it->second;
-    }
-
-    unsigned nodes() const override {
-      return G.size();
+  /* Scratch space for extracting the part of the leveled graph that a LeveledNetwork needs. It is kept per thread, so
+   * that solving many STs in a row doesn't reallocate buffers the size of the whole leveled graph for each one. Marks
+   * are stamped with the extraction they belong to, so they never need clearing.
+   */
+  struct LeveledScratch {
+    std::vector<unsigned> fwd; // reachable from a source
+    std::vector<unsigned> bwd; // also reaches a sink
+    std::vector<unsigned> ids; // compact id, where bwd is stamped
+    std::vector<Node> todo;
+    std::vector<Node> order; // leveled nodes stamped in bwd, by compact id
+    unsigned epoch = 0;
+
+    void reset(unsigned N) {
+      if (fwd.size() < N) {
+	fwd.resize(N, 0);
+	bwd.resize(N, 0);
+	ids.resize(N);
+      }
+      if (++epoch == 0) {
+	std::fill(fwd.begin(), fwd.end(), 0);
+	std::fill(bwd.begin(), bwd.end(), 0);
+	epoch = 1;
+      }
+      todo.clear();
+      order.clear();
     }
-    
-  private:
-    const std::vector<Dsts>& G;
   };
 
-  #if 0
-  template <class BaseGraph>
-  class DupGraph final : public ImmutableGraph {
+  /* Residual network for a multi-waypoint min cut, laid out flat on top of a CSRGraph. Node (u, l) is copy l of u,
+   * and a copy-l edge u->v is lifted to (v, l+1) iff v is in waypoint set l+1. All of level 0's first waypoint set are
+   * sources and all of the last level's last waypoint set are sinks, so every source-sink path passes through the
+   * waypoint sets in order. Edges that are cut in the CSRGraph get capacity 0, so that sync() can later cut and restore
+   * edges in place while keeping the current flow.
+   * Only the copies that are reachable from a source and reach a sink are built, and they are numbered compactly: no
+   * flow can pass through any other node, nor can any other node be on the source side of the cut. Most STs only span
+   * a small part of a large function, so this is usually far smaller than levels copies of the whole graph. Unless
+   * keep_cut_edges is set, reachability only follows live edges and cut edges are left out entirely; the network must
+   * then not be sync()ed.
+   * Since the set of nodes reachable from the sources in a maximum flow's residual graph doesn't depend on which
+   * maximum flow we found, both engines produce exactly the same cut.
+   */
+  class LeveledNetwork {
   public:
-    using Level = unsigned;
+    using Flow = uint64_t;
     
-    DupGraph(const BaseGraph *orig, Level levels): G(*orig), levels(levels) {
-      assert(levels >= 1);
-    }
-
-    unsigned nodes() const override {
-      return G.nodes() * levels;
-    }
-
-  private:
-    using base_iterator = typename BaseGraph::iterator;
-    using base_range_type = typename BaseGraph::range_type;
-  public:
-    class iterator {
-    private:
-      llvm::iterator_range<base_iterator> real;
-      base_iterator it;
-      Level level;
-      unsigned nodes;
-    public:
-      iterator(): real(base_iterator(), base_iterator()) {}
-      iterator(const llvm::iterator_range<base_iterator>& real, base_iterator it, Level level, unsigned nodes):
-	real(real), it(it), level(level), nodes(nodes) {}
-
-      const std::pair<const Node, Weight> operator*() const {
-	std::pair<Node, Weight> p = *it;
-	p.first += level * nodes;
-	return p;
-      }
-
-      iterator& operator++() {
-	assert(it != real.end());
-	++it;
-	if (it == real.end()) {
-	  ++level;
-	  it = real.begin();
+    LeveledNetwork(const CSRGraph& G, llvm::ArrayRef<std::set<Node>> waypoint_sets, bool keep_cut_edges):
+      n(G.nodes()), m(G.arcs()), levels(waypoint_sets.size()) {
+      assert(levels >= 2);
+      static thread_local LeveledScratch scratch;
+      const auto dst_level = [&] (Node v, unsigned l) -> unsigned {
+	return (l + 1 < levels && waypoint_sets[l + 1].contains(v)) ? l + 1 : l;
+      };
+      const auto usable = [&] (CSRGraph::Arc a) {
+	return keep_cut_edges || G.is_live(a);
+      };
+      extract(G, waypoint_sets, usable, scratch);
+      const unsigned N = scratch.order.size();
+      const auto id = [&] (Node u, unsigned l) {
+	return scratch.ids[node(u, l)];
+      };
+      const auto relevant = [&] (Node u, unsigned l) {
+	return scratch.bwd[node(u, l)] == scratch.epoch;
+      };
+
+      // Count arcs per node so that we can lay them out contiguously.
+      offsets.assign(N + 1, 0);
+      for (unsigned x = 0; x < N; ++x) {
+	const Node u = scratch.order[x] % n;
+	const unsigned l = scratch.order[x] / n;
+	for (CSRGraph::Arc a : G.fwd_arcs(u)) {
+	  const Node v = G.target(a);
+	  if (usable(a) && relevant(v, dst_level(v, l))) {
+	    ++offsets[x + 1];
+	    ++offsets[id(v, dst_level(v, l)) + 1];
+	  }
 	}
-	return *this;
-      }
-
-      iterator& operator++(int) {
-	return this->operator++();
       }
-
-      bool operator==(const iterator& o) const {
-	assert(real.begin() == o.real.begin() && real.end() == o.real.end() && nodes == o.nodes);
-	return it == o.it && level == o.level;
+      std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+      arcs.resize(offsets.back());
+
+      std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+      bases.resize(N);
+      for (unsigned src = 0; src < N; ++src) {
+	const Node u = scratch.order[src] % n;
+	const unsigned l = scratch.order[src] / n;
+	bases[src] = u;
+	for (CSRGraph::Arc a : G.fwd_arcs(u)) {
+	  const Node v = G.target(a);
+	  if (!usable(a) || !relevant(v, dst_level(v, l)))
+	    continue;
+	  const Node dst = id(v, dst_level(v, l));
+	  const unsigned fwd = fill[src]++;
+	  const unsigned bwd = fill[dst]++;
+	  arcs[fwd] = {.dst = dst, .rev = bwd, .cap = G.capacity(a), .base = a};
+	  arcs[bwd] = {.dst = src, .rev = fwd, .cap = 0, .base = none};
+	  copies.emplace_back(a, fwd);
+	}
       }
+      llvm::sort(copies);
+      live = G.removed_edges();
+      live.flip();
 
-      bool operator!=(const iterator& o) const {
-	return !this->operator==(o);
+      is_source.resize(N, false);
+      for (Node s : waypoint_sets.front()) {
+	if (relevant(s, 0)) {
+	  sources.push_back(id(s, 0));
+	  is_source.set(id(s, 0));
+	}
       }
-    };
-
-    using range_type = llvm::iterator_range<iterator>;
-
-    range_type operator[](Node src) const {
-      assert(src / G.nodes() < levels);
-      const auto real = G[src % G.nodes()];
-      const iterator begin(real, real.begin(), 0, G.nodes());
-      const iterator end(real, real.begin(), levels, G.nodes());
-      if (real.empty())
-	return range_type(end, end);
-      else
-	return range_type(begin, end);
-    }
-
-    Weight get_weight(Node src, Node dst) const override {
-      return G.get_weight(src % G.nodes(), dst % G.nodes());
+      sinks.resize(N, false);
+      for (Node t : waypoint_sets.back())
+	if (relevant(t, levels - 1))
+	  sinks.set(id(t, levels - 1));
     }
 
-    Node get_last_level_node(Node v) const {
-      assert(v / G.nodes() == 0);
-      return v + (levels - 1) * G.nodes();
-    }
-
-    Node get_first_level_node(Node v) const {
-      return v % G.nodes();
-    }
-
-    Node get_node_for_level(Node v, Level l) const {
-      assert(v < G.nodes());
-      assert(l < levels);
-      return v + G.nodes() * l;
-    }
-    
-  private:
-    const BaseGraph& G;
-    unsigned levels;
-  };
-#elif 0
-  template <class BaseGraph>
-  class DupGraph final : public ImmutableGraph {
-    static_assert(std::is_base_of_v<Graph, BaseGraph>, "Base graph must be derived from Graph class");
-  public:
-    DupGraph(const BaseGraph *orig): G(*orig) {}
-
-    unsigned nodes() const override {
-      return G.nodes() * 2;
+    Flow run(MaxFlowAlgorithm algorithm) {
+      switch (algorithm) {
+      case MaxFlowAlgorithm::FordFulkerson: return run_ford_fulkerson();
+      case MaxFlowAlgorithm::Dinic: return run_dinic();
+      }
+      std::abort();
     }
 
-  private:
-    using base_iterator = typename BaseGraph::iterator;
-    using base_range_type = typename BaseGraph::range_type;
-  public:
-    class iterator {
-    public:
-      iterator(): real(base_iterator(), base_iterator()) {}
-      iterator(const llvm::iterator_range<base_iterator>& real, base_iterator it, bool shadow, unsigned n): real(real), it(it), shadow(shadow), n(n) {}
-
-      const std::pair<const Node, Weight> operator*() const {
-	std::pair<Node, Weight> p = *it;
-	if (shadow)
-	  p.first += n;
-	return p;
-      }
-      
-      iterator& operator++() {
-	assert(it != real.end());
-	++it;
-	if (it == real.end() && !shadow) {
-	  shadow = true;
-	  it = real.begin();
+    // Returns the edges crossing from the source side of the min cut to the sink side, as base graph edges.
+    void get_cut(std::vector<std::pair<Node, Node>>& results) const {
+      const llvm::BitVector reach = find_residual_reach();
+      for (const Node u : reach.set_bits())
+	for (unsigned i = offsets[u]; i < offsets[u + 1]; ++i)
+	  if (arcs[i].base != none && live.test(arcs[i].base) && !reach.test(arcs[i].dst))
+	    results.emplace_back(bases[u], bases[arcs[i].dst]);
+    }
+
+    /* Brings the network up to date with the edges currently cut in G, which must be the graph the network was built
+     * from. Flow on newly cut edges is cancelled (see repair()), so the result is still a valid, though maybe no longer
+     * maximum, flow. Returns whether any edge changed.
+     */
+    bool sync(const CSRGraph& G) {
+      assert(G.arcs() == m);
+      llvm::BitVector changed = G.removed_edges();
+      changed.flip();
+      changed ^= live;
+      if (changed.none())
+	return false;
+
+      for (const CSRGraph::Arc a : changed.set_bits()) {
+	const bool now_live = !live.test(a);
+	const auto range = std::equal_range(copies.begin(), copies.end(), std::make_pair(a, 0U),
+					    [] (const auto& x, const auto& y) { return x.first < y.first; });
+	for (const auto& [_, copy] : llvm::make_range(range)) {
+	  Arc& fwd = arcs[copy];
+	  Arc& bwd = arcs[fwd.rev];
+	  if (now_live) {
+	    assert(bwd.cap == 0);
+	    fwd.cap = G.weight(a);
+	  } else {
+	    const Flow flow = bwd.cap;
+	    fwd.cap = bwd.cap = 0;
+	    if (flow > 0) {
+	      add_excess(bwd.dst, flow);
+	      add_excess(fwd.dst, -static_cast<Excess>(flow));
+	    }
+	  }
 	}
-	return *this;
-      }
-
-      iterator& operator++(int) {
-	return operator++();
       }
+      live ^= changed;
 
-      bool operator==(const iterator& o) const {
-	assert(real.begin() == o.real.begin() && real.end() == o.real.end() && n == o.n);
-	if (it == real.end())
-	  return o.it == real.end();
-	else
-	  return it == o.it && shadow == o.shadow;
-      }
-
-      bool operator!=(const iterator& o) const {
-	return !operator==(o);
-      }
-      
-    private:
-      llvm::iterator_range<base_iterator> real;
-      base_iterator it;
-      bool shadow;
-      unsigned n;
-
-      bool isEnd() const {
-	return it == real.end();
-      }
-    };
-
-    using range_type = llvm::iterator_range<iterator>;
-
-    range_type operator[](Node src) const {
-      const auto real = (src < G.nodes()) ? G[src] : G.empty_range();
-      const iterator begin(real, real.begin(), false, G.nodes());
-      const iterator end(real, real.end(), true, G.nodes());
-      return range_type(begin, end);
+      repair();
+      return true;
     }
 
-    Weight get_weight(Node src, Node dst) const override {
-      if (src >= G.nodes())
-	return 0;
-      if (dst >= G.nodes())
-	dst -= G.nodes();
-      return G.get_weight(src, dst);
+    unsigned size() const {
+      return arcs.size();
     }
 
-    Node get_shadow_node(Node v) const {
-      assert(v < G.nodes());
-      return v + G.nodes();
-    }
-
-    Node get_real_node(Node v) const {
-      assert(v >= G.nodes());
-      return v - G.nodes();
-    }
-    
   private:
-    const BaseGraph& G;
-  };
-#else
-  template <class BaseGraph>
-  class DupGraph final : public ImmutableGraph {
-  public:
-    using Level = unsigned;
-  private:
-    const BaseGraph& G;
-    Level levels;
-  public:
-    DupGraph(const BaseGraph *orig, Level levels): G(*orig), levels(levels) {
-      assert(levels >= 1);
-    }
-
-    unsigned nodes() const override {
-      return G.nodes() * levels;
-    }
+    using Excess = int64_t;
     
-  private:
-    using base_iterator = typename BaseGraph::iterator;
-    using base_range_type = typename BaseGraph::range_type;
-  public:
-    class iterator {
-    private:
-      base_iterator it;
-      unsigned offset;
-    public:
-      iterator() = default;
-      iterator(base_iterator it, unsigned offset): it(it), offset(offset) {}
-
-      const std::pair<const Node, Weight> operator*() const {
-	std::pair<Node, Weight> p = *it;
-	p.first += offset;
-	return p;
-      }
-
-      iterator& operator++() {
-	++it;
-	return *this;
-      }
-
-      iterator& operator++(int) {
-	return this->operator++();
-      }
-
-      bool operator==(const iterator& o) const {
-	assert(offset == o.offset);
-	return it == o.it;
-      }
-
-      bool operator!=(const iterator& o) const {
-	return !operator==(o);
-      }
-
-      using iterator_category = typename base_iterator::iterator_category;
+    struct Arc {
+      Node dst;
+      unsigned rev;
+      Flow cap; // residual capacity
+      CSRGraph::Arc base; // `none` for reverse (residual-only) arcs
     };
 
-    using range_type = llvm::iterator_range<iterator>;
-    
-  private:
-    Level get_level(Node v) const {
-      return v / G.nodes();
-    }
-
-    Node get_base(Node v) const {
-      return v % G.nodes();
-    }
-  public:
-    range_type operator[](Node src) const {
-      const auto range = G[get_base(src)];
-      const unsigned offset = get_level(src) * G.nodes();
-      const iterator begin(range.begin(), offset);
-      const iterator end(range.end(), offset);
-      return range_type(begin, end);
-    }
-
-    Weight get_weight(Node src, Node dst) const override {
-      if (get_level(src) == get_level(dst))
-	return G.get_weight(get_base(src), get_base(dst));
-      else
-	return 0;
-    }
-
-    Node get_first_level_node(Node v) const {
-      return v % G.nodes();
-    }
-
-    Node get_node_for_level(Node v, Level l) const {
-      assert(v < G.nodes());
-      return v + G.nodes() * l;
-    }
-
-    Node inc_level(Node v) const {
-      return get_node_for_level(v, get_level(v) + 1);
-    }
-
-    Node dec_level(Node v) const {
-      return get_node_for_level(v, get_level(v) - 1);
-    }
-  };
-  
-#endif
-
-  template <class BaseGraph>
-  class ScopedGraph final : public MutableGraph {
-    static_assert(std::is_base_of_v<Graph, BaseGraph>, "Base graph must be derived from Graph class");
-  public:
-    ScopedGraph(const BaseGraph *orig): orig(*orig) {}
-
-    unsigned nodes() const override {
-      return orig.nodes();
-    }
-
-    class iterator {
-    public:
-      using orig_iterator = typename BaseGraph::iterator;
-      using mod_iterator = Dsts::const_iterator;
-      iterator() {}
-      iterator(orig_iterator it): orig(true), orig_it(it) {}
-      iterator(mod_iterator it): orig(false), mod_it(it) {}
-
-      std::pair<const Node, Weight> operator*() const {
-	if (orig)
-	  return *orig_it;
-	else
-	  return *mod_it;
-      }
-
-      iterator& operator++() {
-	if (orig)
-	  ++orig_it;
-	else
-	  ++mod_it;
-	return *this;
-      }
-
-      bool operator==(const iterator& o) const {
-	assert(orig == o.orig);
-	if (orig)
-	  return orig_it == o.orig_it;
-	else
-	  return mod_it == o.mod_it;
-      }
-
-      bool operator!=(const iterator& o) const {
-	return !operator==(o);
-      }
-
-    private:
-      bool orig;
-      orig_iterator orig_it;
-      mod_iterator mod_it;
-    };
-
-    using range_type = llvm::iterator_range<iterator>;
-
-    range_type operator[](Node src) const {
-      const auto it = mod.find(src);
-      iterator begin, end;
-      if (it != mod.end()) {
-	begin = iterator(it->second.begin());
-	end = iterator(it->second.end());
-      } else {
-	const auto orig_range = orig[src];
-	begin = iterator(orig_range.begin());
-	end = iterator(orig_range.end());
-      }
-      return range_type(begin, end);
-    }
-
-    Weight get_weight(Node src, Node dst) const override {
-      const auto mod_src_it = mod.find(src);
-      if (mod_src_it != mod.end()) {
-	const auto& mod_dsts = mod_src_it->second;
-	const auto mod_dst_it = mod_dsts.find(dst);
-	if (mod_dst_it != mod_dsts.end())
-	  return mod_dst_it->second;
-	else
-	  return 0;
-      } else {
-	return orig.get_weight(src, dst);
-      }
-    }
-
-    void put_weight(Node src, Node dst, Weight w) override {
-      // NOTE: It's ok if weight is 0. This means removing an edge.
-      auto it = mod.find(src);
-      if (it == mod.end()) {
-	it = mod.emplace(src, std::map<Node, Weight>()).first;
-#if 0
-	llvm::copy(orig[src], std::inserter(it->second, it->second.end()));
-#else
-	for (const auto& p : orig[src])
-	  it->second.insert(p);
-#endif
-      }
-      if (w > 0)
-	it->second[dst] = w;
-      else
-	it->second.erase(dst);
-    }
+    static constexpr unsigned unreached = std::numeric_limits<unsigned>::max();
+    static constexpr unsigned none = std::numeric_limits<unsigned>::max();
     
-  private:
-    const BaseGraph& orig;
-    std::map<Node, Dsts> mod;
-  };
-
-  template <class Graph1, class Graph2>
-  class IntersectUnitGraph final : public ImmutableGraph {
-  public:
-    IntersectUnitGraph(const Graph1 *G1, const Graph2 *G2): G1(*G1), G2(*G2) {
-      assert(this->G1.nodes() == this->G2.nodes());
-    }
-
-    unsigned nodes() const override {
-      return G1.nodes();
-    }
-
-    const std::map<Node, Weight> operator[](Node src) const {
-      std::map<Node, Weight> dsts1, dsts2;
-      llvm::transform(G1[src], std::inserter(dsts1, dsts1.end()), [] (const auto& p) {
-	return std::make_pair(p.first, 1);
-      });
-      llvm::transform(G2[src], std::inserter(dsts2, dsts2.end()), [] (const auto& p) {
-	return std::make_pair(p.first, 1);
-      });
-      std::map<Node, Weight> dsts;
-      std::set_intersection(dsts1.begin(), dsts1.end(), dsts2.begin(), dsts2.end(), std::inserter(dsts, dsts.end()));
-      return dsts;
-    }
-
-    Weight get_weight(Node src, Node dst) const override { std::abort(); }
-
-  private:
-    const Graph1& G1;
-    const Graph2& G2;
-  };
-
-  template <class BaseGraph>
-  static bool find_st_path(int n, const BaseGraph& G, int s, int t, std::vector<int>& path) {
-    static_assert(std::is_base_of_v<Graph, BaseGraph>, "");
-    std::vector<int> parent(n, -1);
-    llvm::BitVector visited(n, false);
-    std::queue<int> queue;
-    queue.push(s);
-
-    while (!queue.empty()) {
-      int u = queue.front();
-      queue.pop();
-
-      for (const auto& [v, w] : G[u]) {
-	if (!visited.test(v) && w > 0) {
-	  queue.push(v);
-	  parent[v] = u;
-	  visited.set(v);
+    unsigned n;
+    unsigned m; // arcs in the base graph
+    unsigned levels;
+    std::vector<unsigned> offsets;
+    std::vector<Arc> arcs;
+    std::vector<Node> bases; // base node of each leveled node
+    std::vector<std::pair<CSRGraph::Arc, unsigned>> copies; // leveled copies of each base arc, sorted
+    llvm::BitVector live; // base arcs that currently have capacity
+    std::vector<Excess> excess; // inflow minus outflow; only nonzero in the middle of sync()
+    std::vector<Node> unbalanced;
+    std::vector<Node> sources;
+    llvm::BitVector is_source;
+    llvm::BitVector sinks;
+    std::vector<unsigned> dist;
+    std::vector<unsigned> its;
+
+    // Index of (u, l) in the full leveled graph, before extraction.
+    Node node(Node u, unsigned l) const {
+      return u + l * n;
+    }
+
+    /* Stamps the leveled nodes that are reachable from a source and reach a sink over usable arcs, and numbers them in
+     * scratch.order. Neither search continues past a terminal: the engines never route flow through one.
+     */
+    template <class Usable>
+    void extract(const CSRGraph& G, llvm::ArrayRef<std::set<Node>> waypoint_sets, Usable usable,
+		 LeveledScratch& scratch) const {
+      const unsigned N = n * levels;
+      scratch.reset(N);
+      const unsigned epoch = scratch.epoch;
+      const auto stamp = [&] (std::vector<unsigned>& marks, Node x) {
+	if (marks[x] == epoch)
+	  return false;
+	marks[x] = epoch;
+	return true;
+      };
+      const auto number = [&] (Node x) {
+	scratch.ids[x] = scratch.order.size();
+	scratch.order.push_back(x);
+      };
+
+      if (!prune_flow_networks) {
+	for (Node x = 0; x < N; ++x) {
+	  scratch.fwd[x] = scratch.bwd[x] = epoch;
+	  number(x);
 	}
-      }
-    }
-
-    if (!visited.test(t))
-      return false;
-
-    // prepare path
-    assert(path.empty());
-    int v = t;
-    do {
-      assert(v >= 0);
-      path.push_back(v);
-      const int u = parent[v];
-      assert(u >= 0);
-      assert(G[u].at(v) > 0);
-      v = u;
-    } while (v != s);
-    path.push_back(v);
-    std::reverse(path.begin(), path.end());
-#ifndef NDEBUG
-    for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2)
-      assert(G[*it1].at(*it2) > 0);
-#endif
-    return true;
-  }
-
-  template <class BaseGraph>
-  static bool find_st_path_multi(const BaseGraph& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets,
-				 std::vector<unsigned>& path) {
-    static_assert(std::is_base_of_v<Graph, BaseGraph>, "");
-    const auto n = G.nodes();
-    assert(waypoint_sets.size() >= 2);
-    assert(path.empty());
-
-    std::vector<std::vector<int>> parents;
-
-    std::set<unsigned> S = waypoint_sets.front();
-    std::vector<std::set<unsigned>> waypoints_reached;
-    for (int i = 0; const std::set<unsigned>& T : waypoint_sets.drop_front()) {
-      waypoints_reached.push_back(S);
-      
-      llvm::BitVector visited(n, false);
-      std::vector<int>& parent = parents.emplace_back(n, -1);
-      std::stack<unsigned> queue;
-      for (auto s : S)
-	queue.push(s);
-
-      // Find all the nodes reachable from each s \in S. 
-      while (!queue.empty()) {
-	const unsigned u = queue.top();
-	queue.pop();
-	for (const auto& [v, w] : G[u]) {
-	  if (visited.test(v))
+	return;
+      }
+
+      const auto at_source = [&] (Node u, unsigned l) {
+	return l == 0 && waypoint_sets.front().contains(u);
+      };
+      const auto at_sink = [&] (Node u, unsigned l) {
+	return l + 1 == levels && waypoint_sets.back().contains(u);
+      };
+
+      // Forward from the sources.
+      auto& todo = scratch.todo;
+      for (Node s : waypoint_sets.front())
+	if (stamp(scratch.fwd, node(s, 0)))
+	  todo.push_back(node(s, 0));
+      for (size_t i = 0; i < todo.size(); ++i) {
+	const Node u = todo[i] % n;
+	const unsigned l = todo[i] / n;
+	if (at_sink(u, l))
+	  continue;
+	for (CSRGraph::Arc a : G.fwd_arcs(u)) {
+	  if (!usable(a))
 	    continue;
-	  queue.push(v);
-	  parent[v] = u;
-	  visited.set(v);
+	  const Node v = G.target(a);
+	  const unsigned lv = (l + 1 < levels && waypoint_sets[l + 1].contains(v)) ? l + 1 : l;
+	  if (stamp(scratch.fwd, node(v, lv)))
+	    todo.push_back(node(v, lv));
 	}
       }
 
-      // Copy over the vertices that were reached. 
-      S.clear();
-      llvm::copy_if(T, std::inserter(S, S.end()), [&visited] (unsigned t) -> bool { return visited.test(t); });
-    }
-    waypoints_reached.push_back(S);
-
-    if (S.empty()) {
-      // No multi-s-t path was found.
-      return false;
-    }
-    
-    // Find multi-s-t path.
-    {
-      unsigned t = *waypoints_reached.back().begin();
-      for (const auto& [parent, waypoint_set] : llvm::reverse(llvm::zip(parents, llvm::ArrayRef(waypoints_reached).drop_back()))) {
-	int v = static_cast<int>(t);
-	while (true) {
-	  path.push_back(v);
-	  v = parent[v];
-	  assert(v >= 0);
-	  if (waypoint_set.contains(v))
-	    break;
+      // Backward from the sinks, within what the forward search reached.
+      todo.clear();
+      for (Node t : waypoint_sets.back()) {
+	const Node x = node(t, levels - 1);
+	if (scratch.fwd[x] == epoch && stamp(scratch.bwd, x))
+	  todo.push_back(x);
+      }
+      for (size_t i = 0; i < todo.size(); ++i) {
+	const Node v = todo[i] % n;
+	const unsigned l = todo[i] / n;
+	number(todo[i]);
+	if (at_source(v, l))
+	  continue;
+	// (u, l) -> (v, l) unless v is in the next waypoint set; (u, l-1) -> (v, l) if v is in this one.
+	const bool same_level = l + 1 == levels || !waypoint_sets[l + 1].contains(v);
+	const bool prev_level = l > 0 && waypoint_sets[l].contains(v);
+	for (CSRGraph::Arc b : G.rev_arcs(v)) {
+	  if (!usable(b))
+	    continue;
+	  const Node u = G.target(b);
+	  for (const auto& [ok, lu] : {std::make_pair(same_level, l), std::make_pair(prev_level, l - 1)}) {
+	    if (!ok)
+	      continue;
+	    const Node x = node(u, lu);
+	    if (scratch.fwd[x] == epoch && stamp(scratch.bwd, x))
+	      todo.push_back(x);
+	  }
 	}
-	t = v;
       }
-      path.push_back(t);
     }
 
-    std::reverse(path.begin(), path.end());
-    return true;
-  }
-
-  template <class graph_type>
-  static llvm::BitVector find_reachable(int n, const graph_type& G, int s) {
-    llvm::BitVector reach(n, false);
-    std::stack<int> stack;
-    stack.push(s);
-    while (!stack.empty()) {
-      int u = stack.top();
-      stack.pop();
-      if (reach.test(u))
-	continue;
-      reach.set(u);
-      for (const auto& [v, w] : G[u])
-	if (w > 0)
-	  stack.push(v);
-    }
-    return reach;
-  }
-
-  template <class GraphT>
-  static llvm::BitVector find_reachable(const GraphT& G, unsigned s) {
-    llvm::BitVector reach(G.nodes(), false);
-    std::stack<unsigned> todo;
-    todo.push(s);
-    while (!todo.empty()) {
-      const unsigned u = todo.top();
-      todo.pop();
-      if (reach.test(u))
-	continue;
-      reach.set(u);
-      for (const auto& [v, w] : G[u])
-	todo.push(v);
-    }
-    return reach;
-  }
-
-  template <class BaseGraph>
-  static llvm::BitVector find_reachable_multi(const BaseGraph& G, const std::set<Graph::Node>& S) {
-    static_assert(std::is_base_of_v<Graph, BaseGraph>, "");
-    const auto n = G.nodes();
-    llvm::BitVector reach(n, false);
-    std::stack<unsigned> stack;
-    for (unsigned s : S)
-      stack.push(s);
-    while (!stack.empty()) {
-      unsigned u = stack.top();
-      stack.pop();
-      if (reach.test(u))
-	continue;
-      reach.set(u);
-      for (const auto& [v, w] : G[u]) {
-	assert(w > 0);
-	stack.push(v);
+    void push(llvm::ArrayRef<unsigned> path, Flow flow) {
+      for (unsigned i : path) {
+	arcs[i].cap -= flow;
+	arcs[arcs[i].rev].cap += flow;
+      }
+    }
+
+    Flow bottleneck(llvm::ArrayRef<unsigned> path) const {
+      Flow flow = std::numeric_limits<Flow>::max();
+      for (unsigned i : path)
+	flow = std::min(flow, arcs[i].cap);
+      assert(flow > 0 && flow < std::numeric_limits<Flow>::max());
+      return flow;
+    }
+
+    // Sources and sinks are unconstrained.
+    bool is_terminal(Node u) const {
+      return is_source.test(u) || sinks.test(u);
+    }
+
+    void add_excess(Node u, Excess delta) {
+      if (is_terminal(u))
+	return;
+      if (excess.empty())
+	excess.resize(offsets.size() - 1, 0);
+      if (excess[u] == 0)
+	unbalanced.push_back(u);
+      excess[u] += delta;
+    }
+
+    /* Restores flow conservation after sync() dropped the flow on some arcs.
+     * Surplus at a node is pushed along a residual path to a node with a deficit or to a source or sink, which are
+     * unconstrained; a remaining deficit is then filled along a residual path from a source or sink. Such paths always
+     * exist: if the residual reach R of a node with surplus contained neither, every arc into R would carry no flow and
+     * every arc out of it would be saturated, so the imbalances in R would sum to at most 0, contradicting the surplus
+     * (and symmetrically for deficits).
+     */
+    void repair() {
+      std::vector<unsigned> parent(offsets.size() - 1);
+      std::vector<unsigned> path;
+
+      // Finds a shortest residual path from u to a node matching `goal`, forwards or backwards, into `path`.
+      const auto find_path = [&] (Node u, bool forward, const auto& goal) -> Node {
+	llvm::BitVector visited(offsets.size() - 1, false);
+	std::queue<Node> todo;
+	visited.set(u);
+	todo.push(u);
+	while (!todo.empty()) {
+	  const Node v = todo.front();
+	  todo.pop();
+	  for (unsigned i = offsets[v]; i < offsets[v + 1]; ++i) {
+	    // Backwards, arc i's twin is the residual arc w->v.
+	    const unsigned j = forward ? i : arcs[i].rev;
+	    const Node w = arcs[i].dst;
+	    if (arcs[j].cap == 0 || visited.test(w))
+	      continue;
+	    visited.set(w);
+	    parent[w] = j;
+	    if (goal(w)) {
+	      path.clear();
+	      for (Node x = w; x != u; x = forward ? arcs[arcs[parent[x]].rev].dst : arcs[parent[x]].dst)
+		path.push_back(parent[x]);
+	      return w;
+	    }
+	    todo.push(w);
+	  }
+	}
+	llvm_unreachable("no residual path to rebalance flow");
+      };
+
+      for (const Node u : unbalanced) {
+	while (excess[u] > 0) {
+	  const Node v = find_path(u, true, [&] (Node v) {
+	    return is_terminal(v) || excess[v] < 0;
+	  });
+	  Flow flow = std::min<Flow>(excess[u], bottleneck(path));
+	  if (!is_terminal(v))
+	    flow = std::min<Flow>(flow, -excess[v]);
+	  push(path, flow);
+	  excess[u] -= flow;
+	  if (!is_terminal(v))
+	    excess[v] += flow;
+	}
       }
-    }
-    return reach;
-  }
 
-#if 0
-  std::vector<std::pair<int, int>> ford_fulkerson(unsigned n, Graph& G, unsigned s, unsigned t) {
-    if (n == 0)
-      return {};
-    
-    const unsigned orig_n = n;
-    if (s == t) {
-      // Duplicate node so that we guarantee s != t.
-      const unsigned t_new = n++;
-
-      // All edges into s/t now go into t_new.
-      for (auto& dsts : G) {
-	const auto it = dsts.find(t);
-	if (it != dsts.end()) {
-	  const unsigned w = it->second;
-	  dsts.erase(it);
-	  dsts[t_new] = w;
+      for (const Node u : unbalanced) {
+	while (excess[u] < 0) {
+	  const Node v = find_path(u, false, [&] (Node v) {
+	    return is_terminal(v) || excess[v] > 0;
+	  });
+	  Flow flow = std::min<Flow>(-excess[u], bottleneck(path));
+	  if (!is_terminal(v))
+	    flow = std::min<Flow>(flow, excess[v]);
+	  push(path, flow);
+	  excess[u] += flow;
+	  if (!is_terminal(v))
+	    excess[v] -= flow;
 	}
       }
 
-      // Add edge from t_new to s.
-      G.push_back({{s, std::numeric_limits<unsigned>::max()}});
-
-      // Replace t with t_new.
-      t = t_new;
+      unbalanced.clear();
     }
 
-      
-    assert(static_cast<size_t>(n) == G.size());
-    assert(s != t);
-
-    ScopedGraph ResG(G);
-
-    std::vector<int> path;
-    while (find_st_path(n, ResG, s, t, path)) {
-      assert(llvm::all_of(G, [] (const std::map<unsigned, unsigned>& x) {
-	return llvm::all_of(x, [] (const auto& p) {
-	  return p.second >= 0;
-	});
-      }));
-      
-      unsigned path_flow = std::numeric_limits<unsigned>::max();
-      assert(path.size() >= 2);
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2)
-	path_flow = std::min(path_flow, ResG[*it1].at(*it2));
-      assert(path_flow > 0);
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2) {
-	ResG.put_weight(*it1, *it2, ResG.get_weight(*it1, *it2) - path_flow);
-	ResG.put_weight(*it2, *it1, ResG.get_weight(*it2, *it1) + path_flow);
-      }
-
-      path.clear();
-    }
+    // Ford-Fulkerson: augment along one source-sink path (found by DFS) at a time.
+    Flow run_ford_fulkerson() {
+      Flow flow = 0;
+      std::vector<unsigned> parent(offsets.size() - 1); // arc used to reach each node
+      std::vector<unsigned> path;
+      llvm::BitVector visited;
+      std::stack<Node> todo;
+      while (true) {
+	visited.reset();
+	visited.resize(offsets.size() - 1, false);
+	todo = std::stack<Node>();
+	for (Node s : sources) {
+	  visited.set(s);
+	  todo.push(s);
+	}
 
-    const llvm::BitVector reach = find_reachable(n, ResG, s);
-    std::vector<std::pair<int, int>> results;
-    for (unsigned u : reach.set_bits()) {
-      for (const auto& [v_, w] : G[u]) {
-	auto v = v_;
-	assert(w > 0);
-	if (!reach.test(v)) {
-	  assert(G.at(u).find(v) != G.at(u).end());
-	  if (orig_n != n) {
-	    assert(u != t);
-	    if (v == t)
-	      v = s;
+	int t = -1;
+	while (!todo.empty() && t < 0) {
+	  const Node u = todo.top();
+	  todo.pop();
+	  for (unsigned i = offsets[u]; i < offsets[u + 1]; ++i) {
+	    const Node v = arcs[i].dst;
+	    if (arcs[i].cap == 0 || visited.test(v))
+	      continue;
+	    visited.set(v);
+	    parent[v] = i;
+	    if (sinks.test(v)) {
+	      t = v;
+	      break;
+	    }
+	    todo.push(v);
 	  }
-	  results.emplace_back(u, v);
 	}
-      }
-    }
-
-#ifndef NDEBUG
-    if (results.empty()) {
-      const llvm::BitVector reach2 = find_reachable(n, G, s);
-      assert(s == t || !reach2.test(t));
-    }
-#endif
-
-    // Revert to original graph
-    if (orig_n != n) {
-      G.pop_back();
-      for (auto& dsts : G) {
-	const auto it = dsts.find(t);
-	if (it != dsts.end()) {
-	  const auto w = it->second;
-	  dsts.erase(it);
-	  dsts[s] = w;
+	if (t < 0)
+	  return flow;
+
+	path.clear();
+	for (Node v = t; !is_source.test(v); ) {
+	  const unsigned i = parent[v];
+	  path.push_back(i);
+	  v = arcs[arcs[i].rev].dst;
 	}
+	const Flow f = bottleneck(path);
+	push(path, f);
+	flow = saturating_add(flow, f);
       }
     }
 
-    assert(orig_n == G.size());
-#if 0
-    assert(llvm::all_of(G, [orig_n] (const auto& dsts) -> bool {
-      return llvm::all_of(dsts, [orig_n] (const auto& p) -> bool {
-	return p.first < orig_n;
-      });
-    }));
-#endif
-    
-    return results;
-  }
-#endif
-
-#if 0
-  std::vector<std::pair<unsigned, unsigned>>
-  ford_fulkerson_multi(unsigned n, Graph& G, const std::set<unsigned>& S_, const std::set<unsigned>& T_) {
-    auto S = S_;
-    auto T = T_;
-    
-    if (n == 0)
-      return {};
-
-    std::map<unsigned, unsigned> dups;
-    {
-      std::set<unsigned> dups_tmp;
-      std::set_intersection(S.begin(), S.end(), T.begin(), T.end(), std::inserter(dups_tmp, dups_tmp.end()));
-      for (unsigned dup : dups_tmp) {
-	const unsigned t_new = n++;
-	[[maybe_unused]] const auto res = dups.emplace(t_new, dup);
-	assert(res.second);
-
-	// All edges into `dup` now go into `t_new`.
-	for (auto& dsts : G) {
-	  const auto it = dsts.find(dup);
-	  if (it != dsts.end()) {
-	    const unsigned w = it->second;
-	    dsts.erase(it);
-	    dsts[t_new] = w;
-	  }
-	}
-
-	// Add edge from `t_new` to `dup`.
-	G.push_back({{dup, std::numeric_limits<unsigned>::max()}});
-
-	// Replace `dup` in `T` with `t_new`.
-	T.erase(dup);
-	T.insert(t_new);
+    // Dinic: augment blocking flows over BFS level graphs.
+    Flow run_dinic() {
+      Flow flow = 0;
+      while (compute_distances()) {
+	its.assign(offsets.begin(), offsets.end() - 1);
+	for (Node s : sources)
+	  flow = saturating_add(flow, augment(s));
       }
+      return flow;
     }
 
-    assert(n == G.size());
-
-    ScopedGraph ResG(G);
-
-    std::vector<unsigned> path;
-    while (find_st_path_multi(n, ResG, S, T, path)) {
-      unsigned path_flow = std::numeric_limits<unsigned>::max();
-      assert(path.size() >= 2);
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2)
-	path_flow = std::min(path_flow, ResG[*it1].at(*it2));
-      assert(path_flow > 0 && path_flow < std::numeric_limits<unsigned>::max());
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2) {
-	ResG.put_weight(*it1, *it2, ResG.get_weight(*it1, *it2) - path_flow);
-	ResG.put_weight(*it2, *it1, ResG.get_weight(*it2, *it1) + path_flow);
+    bool compute_distances() {
+      dist.assign(offsets.size() - 1, unreached);
+      std::queue<Node> todo;
+      for (Node s : sources) {
+	dist[s] = 0;
+	todo.push(s);
       }
-      path.clear();
-    }
-
-    const llvm::BitVector reach = find_reachable_multi(n, ResG, S);
-    std::vector<std::pair<unsigned, unsigned>> results;
-    for (unsigned u : reach.set_bits()) {
-      assert(!T.contains(u));
-      for (const auto& [v_, w] : G[u]) {
-	auto v = v_;
-	assert(w > 0);
-	if (!reach.test(v)) {
-	  assert(G.at(u).find(v) != G.at(u).end());
-	  const auto dup_it = dups.find(v);
-	  if (dup_it != dups.end())
-	    v = dup_it->second;
-	  results.emplace_back(u, v);
+      bool reached_sink = false;
+      while (!todo.empty()) {
+	const Node u = todo.front();
+	todo.pop();
+	if (sinks.test(u)) {
+	  reached_sink = true;
+	  continue;
 	}
-      }
-    }
-
-    // Revert to original graph
-    if (!dups.empty()) {
-      G.resize(G.size() - dups.size());
-      for (auto& dsts : G) {
-	for (const auto& [t_new, t_orig] : dups) {
-	  const auto it = dsts.find(t_new);
-	  if (it != dsts.end()) {
-	    const unsigned w = it->second;
-	    dsts.erase(it);
-	    dsts[t_orig] = w;
+	for (unsigned i = offsets[u]; i < offsets[u + 1]; ++i) {
+	  const Arc& arc = arcs[i];
+	  if (arc.cap > 0 && dist[arc.dst] == unreached) {
+	    dist[arc.dst] = dist[u] + 1;
+	    todo.push(arc.dst);
 	  }
 	}
       }
-    }
+      return reached_sink;
+    }
+
+    // Find a blocking flow from s. Iterative, since the leveled graph can have very long paths.
+    Flow augment(Node s) {
+      Flow total = 0;
+      std::vector<unsigned> path; // arc indices
+      Node u = s;
+      while (true) {
+	if (sinks.test(u)) {
+	  const Flow f = bottleneck(path);
+	  push(path, f);
+	  total = saturating_add(total, f);
+	  path.clear();
+	  u = s;
+	  continue;
+	}
 
-    return results;
-  }
-#endif
-
-  using Node = Graph::Node;
-  using Weight = Graph::Weight;
-
-  template <class GraphT>
-  static void printGraph(const std::string& filename, const GraphT& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets,
-			 const std::set<std::pair<Node, Node>>& cut = {}) {
-    std::ofstream f(filename);
-    llvm::raw_os_ostream os(f);
-    os << "digraph {\n";
-
-    const std::string colors[] = {"green", "yellow", "red"};
-
-    // Define nodes.
-    for (unsigned u = 0; u < G.nodes(); ++u) {
-      os << "node" << u << " [label=\"" << u << "\"";
-      const auto waypoint_it = llvm::find_if(waypoint_sets, [&] (const auto& waypoint_set) {
-	return waypoint_set.contains(u);
-      });
-      if (waypoint_it != waypoint_sets.end()) {
-	os << ", fillcolor=" << colors[waypoint_it - waypoint_sets.begin()] << ", style=filled, fontcolor=black";
-      }
-      os << "];\n";
-    }
+	// Advance along the next admissible arc.
+	unsigned& it = its[u];
+	for (; it < offsets[u + 1]; ++it) {
+	  const Arc& arc = arcs[it];
+	  if (arc.cap > 0 && dist[arc.dst] == dist[u] + 1)
+	    break;
+	}
+	if (it < offsets[u + 1]) {
+	  path.push_back(it);
+	  u = arcs[it].dst;
+	  continue;
+	}
 
-    // Define edges.
-    for (unsigned u = 0; u < G.nodes(); ++u) {
-      for (const auto& [v, w] : G[u]) {
-	os << "node" << u << " -> node" << v << " [label=\"" << w << "\"";
-	if (cut.contains({u, v}))
-	  os << ", color=red";
-	os << "];\n";
-      }
+	// Dead end: retreat.
+	dist[u] = unreached;
+	if (path.empty())
+	  return total;
+	const Arc& back = arcs[arcs[path.back()].rev];
+	path.pop_back();
+	u = back.dst;
+	++its[u];
+      }
+    }
+
+    llvm::BitVector find_residual_reach() const {
+      llvm::BitVector reach(offsets.size() - 1, false);
+      std::stack<Node> todo;
+      for (Node s : sources)
+	todo.push(s);
+      while (!todo.empty()) {
+	const Node u = todo.top();
+	todo.pop();
+	if (reach.test(u))
+	  continue;
+	reach.set(u);
+	for (unsigned i = offsets[u]; i < offsets[u + 1]; ++i)
+	  if (arcs[i].cap > 0)
+	    todo.push(arcs[i].dst);
+      }
+      return reach;
     }
+  };
 
-    os << "}\n";
-  }
-
-  template <class GraphT>
-  static void ford_fulkerson_multi_impl(const GraphT& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets,
-					std::vector<std::pair<Node, Node>>& results) {
-    constexpr unsigned MAX_WEIGHT = std::numeric_limits<unsigned>::max();
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const CSRGraph& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets, MaxFlowAlgorithm algorithm) {
     assert(waypoint_sets.size() >= 2);
+    std::vector<std::pair<Node, Node>> results;
     if (G.nodes() == 0)
-      return;
-
-    ScopedGraph ResG(&G);
-
-    std::vector<unsigned> path;
-    while (find_st_path_multi(ResG, waypoint_sets, path)) {
-      unsigned path_flow = MAX_WEIGHT;
-      assert(path.size() >= 2);
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2)
-	path_flow = std::min(path_flow, ResG.get_weight(*it1, *it2));
-      assert(path_flow > 0 && path_flow < std::numeric_limits<unsigned>::max());
-      for (auto it1 = path.begin(), it2 = std::next(it1); it2 != path.end(); ++it1, ++it2) {
-	ResG.put_weight(*it1, *it2, ResG.get_weight(*it1, *it2) - path_flow);
-	ResG.put_weight(*it2, *it1, ResG.get_weight(*it2, *it1) + path_flow);
-      }
-      path.clear();
-    }
-
-#if 0
-    printGraph("residual.dot", ResG, waypoint_sets);
-#endif
-
-#if 0
-    {
-      for (const auto& S : waypoint_sets.drop_back()) {
-	const llvm::BitVector reach = find_reachable_multi(ResG, S);
-	for (const Node u : reach.set_bits())
-	  for (const auto& [v, w] : G[u])
-	    if (!reach.test(v))
-	      results.emplace_back(u, v);
-      }
-    }
-#else
-    {
-      const auto& S = waypoint_sets.front();
-      const llvm::BitVector reach = find_reachable_multi(ResG, S);
-      for (const Node u : reach.set_bits())
-	for (const auto& [v, w] : G[u])
-	  if (!reach.test(v))
-	    results.emplace_back(u, v);
-    }
-#endif
+      return results;
+    
+    LeveledNetwork network(G, waypoint_sets, false);
+    network.run(algorithm);
+    network.get_cut(results);
 
-#if 0
-    {
-      const IntersectUnitGraph IntersectG(&G, &ResG);
-      printGraph("intersect.dot", IntersectG, waypoint_sets);
-    }
-#endif
+    llvm::sort(results);
+    results.erase(std::unique(results.begin(), results.end()), results.end());
+    return results;
   }
 
   std::vector<std::pair<unsigned, unsigned>>
-  ford_fulkerson_multi(const std::vector<std::map<unsigned, unsigned>>& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets) {
-    const ImmutableVectorGraph OrigG(&G);
-    const DupGraph DupG(&OrigG, waypoint_sets.size());
-    ScopedGraph ModG(&DupG); // For manually adding in connections from different levels.
-    
-    // Need to replace last transmitters with their shadow nodes.
-    std::vector<std::set<unsigned>> waypoints_mod(waypoint_sets.size());
-    for (unsigned i = 0; const auto& [in, out] : llvm::zip(waypoint_sets, waypoints_mod)) {
-      llvm::transform(in, std::inserter(out, out.end()), [&] (Node u) -> Node {
-	return DupG.get_node_for_level(u, i);
-      });
-
-      if (i > 0)
-	for (Node u = 0; u < OrigG.nodes(); ++u) {
-	  for (const auto& [v, w] : OrigG[u]) {
-	    if (in.contains(v)) {
-	      // Add level-up u->v edge.
-	      ModG.put_weight(DupG.get_node_for_level(u, i - 1),
-			      DupG.get_node_for_level(v, i),
-			      w);
-
-	      // Delete same-level u->v edge.
-	      ModG.put_weight(DupG.get_node_for_level(u, i - 1),
-			      DupG.get_node_for_level(v, i - 1),
-			      0);
-	    }
-	  }
-
-	}
-      
-      ++i;
-    }
+  ford_fulkerson_multi(const CSRGraph& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets) {
+    return ford_fulkerson_multi(G, waypoint_sets, max_flow_algorithm);
+  }
 
-    // printGraph("graph.dot", DupG, waypoints_mod);
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const std::vector<std::map<unsigned, unsigned>>& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets,
+		       MaxFlowAlgorithm algorithm) {
+    return ford_fulkerson_multi(CSRGraph(G), waypoint_sets, algorithm);
+  }
 
-    std::vector<std::pair<Node, Node>> results;
-    ford_fulkerson_multi_impl(ModG, waypoints_mod, results);
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const std::vector<std::map<unsigned, unsigned>>& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets) {
+    return ford_fulkerson_multi(G, waypoint_sets, max_flow_algorithm);
+  }
+  
+  IncrementalMinCut::IncrementalMinCut(llvm::ArrayRef<std::set<unsigned>> waypoint_sets, MaxFlowAlgorithm algorithm):
+    waypoint_sets(waypoint_sets.begin(), waypoint_sets.end()), algorithm(algorithm) {}
 
-    // Convert results back to real.
-    for (auto& e : results) {
-      e.first = DupG.get_first_level_node(e.first);
-      e.second = DupG.get_first_level_node(e.second);
-    }
+  IncrementalMinCut::IncrementalMinCut(IncrementalMinCut&&) = default;
+  IncrementalMinCut& IncrementalMinCut::operator=(IncrementalMinCut&&) = default;
+  IncrementalMinCut::~IncrementalMinCut() = default;
 
-    llvm::sort(results);
-#if 0
-#ifndef NDEBUG
-    if (results.size() >= 2) {
-      llvm::ArrayRef<std::pair<Node, Node>> results_ref(results);
-      for (const auto& [p1, p2] : llvm::zip(results_ref.drop_back(), results_ref.drop_front()))
-	if (p1 == p2)
-	  llvm::WithColor::warning() << "duplicate cut edges\n";
-    }
-#endif
-#endif
-    {
-      const auto new_results_end = std::unique(results.begin(), results.end());
-      results.resize(new_results_end - results.begin());
+  const std::vector<std::pair<unsigned, unsigned>>& IncrementalMinCut::solve(const CSRGraph& G) {
+    assert(waypoint_sets.size() >= 2);
+    if (G.nodes() == 0)
+      return cut;
+    
+    if (network) {
+      if (!network->sync(G))
+	return cut; // Nothing changed, so neither did the maximum flow.
+    } else {
+      // Keep the cut edges, so that sync() can restore them later.
+      network = std::make_unique<LeveledNetwork>(G, waypoint_sets, true);
     }
     
-    return results;
+    network->run(algorithm);
+    cut.clear();
+    network->get_cut(cut);
+    llvm::sort(cut);
+    cut.erase(std::unique(cut.begin(), cut.end()), cut.end());
+    return cut;
+  }
+
+  unsigned IncrementalMinCut::size() const {
+    return network ? network->size() : 0;
+  }
+
+  void IncrementalMinCut::release() {
+    network.reset();
   }
   
 }
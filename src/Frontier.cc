@@ -6,8 +6,8 @@
 
 namespace clou {
 
-  ISet reachable_predecessors(llvm::Instruction *root) {
-    ISet seen;
+  NumberedISet reachable_predecessors(llvm::Instruction *root, const DenseNumbering& N) {
+    NumberedISet seen(N);
     IQueue todo;
     todo.push(root);
     while (!todo.empty()) {
@@ -25,15 +25,15 @@ namespace clou {
   namespace {
     template <class NextFunc>
     bool frontier_impl(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier,
-		       NextFunc nexts) {
+		       const DenseNumbering& N, NextFunc nexts) {
       auto& F = *endpoint->getFunction();
-      const auto subgraph = reachable_predecessors(endpoint);
-      ISet in;
-      copy_if(F, std::inserter(in, in.end()), [&] (llvm::Instruction *I) -> bool {
-	return subgraph.contains(I) && pred(I);
-      });
+      const auto subgraph = reachable_predecessors(endpoint, N);
+      NumberedISet in(N);
+      for (llvm::Instruction *I : subgraph)
+	if (pred(I))
+	  in.insert(I);
 
-      ISet seen;
+      NumberedISet seen(N);
       IQueue todo;
       todo.push(&F.getEntryBlock().front());
       bool result = true;
@@ -58,12 +58,14 @@ namespace clou {
     }
   }
 
-  bool forward_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier) {
-    return frontier_impl(endpoint, pred, frontier, &llvm::successors_inst);
+  bool forward_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier,
+			const DenseNumbering& N) {
+    return frontier_impl(endpoint, pred, frontier, N, &llvm::successors_inst);
   }
 
-  bool reverse_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier) {
-    return frontier_impl(endpoint, pred, frontier, [] (llvm::Instruction *I) { return llvm::predecessors(I); });
+  bool reverse_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier,
+			const DenseNumbering& N) {
+    return frontier_impl(endpoint, pred, frontier, N, [] (llvm::Instruction *I) { return llvm::predecessors(I); });
   }
   
 }
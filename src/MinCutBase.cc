@@ -12,4 +12,52 @@ namespace clou {
     llvm::cl::init(true),
   };
 
+  unsigned min_cut_warm_start_limit;
+  static llvm::cl::opt<unsigned, true> min_cut_warm_start_limit_flag {
+    "clou-min-cut-warm-start-limit",
+    llvm::cl::desc("Maximum number of residual arcs kept across min-cut rounds to warm-start max-flow (0 disables)"),
+    llvm::cl::location(min_cut_warm_start_limit),
+    llvm::cl::init(1U << 25),
+  };
+
+  unsigned min_cut_threads;
+  static llvm::cl::opt<unsigned, true> min_cut_threads_flag {
+    "clou-min-cut-threads",
+    llvm::cl::desc("Number of threads that solve STs in parallel in each min-cut round (1 is sequential)"),
+    llvm::cl::location(min_cut_threads),
+    llvm::cl::init(1),
+  };
+
+  unsigned min_cut_batch;
+  static llvm::cl::opt<unsigned, true> min_cut_batch_flag {
+    "clou-min-cut-batch",
+    llvm::cl::desc("Number of STs solved against the same graph in parallel mode (default: 4 per thread)"),
+    llvm::cl::location(min_cut_batch),
+    llvm::cl::init(0),
+  };
+
+  bool condense_min_cut_graph;
+  static llvm::cl::opt<bool, true> condense_min_cut_graph_flag {
+    "clou-min-cut-condense",
+    llvm::cl::desc("Collapse straight-line runs of non-waypoint nodes before solving min cuts"),
+    llvm::cl::location(condense_min_cut_graph),
+    llvm::cl::init(true),
+  };
+
+  bool subsume_min_cut_sts;
+  static llvm::cl::opt<bool, true> subsume_min_cut_sts_flag {
+    "clou-min-cut-subsume",
+    llvm::cl::desc("Drop two-set STs whose paths all contain a path of another ST, by dominance"),
+    llvm::cl::location(subsume_min_cut_sts),
+    llvm::cl::init(true),
+  };
+
+  unsigned reach_index_limit;
+  static llvm::cl::opt<unsigned, true> reach_index_limit_flag {
+    "clou-reach-index-limit",
+    llvm::cl::desc("Maximum number of strongly connected components for which ST optimization precomputes transitive closures"),
+    llvm::cl::location(reach_index_limit),
+    llvm::cl::init(1U << 14),
+  };
+
 }
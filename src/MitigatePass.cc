@@ -1,5 +1,6 @@
 
 #include <ctime>
+#include <chrono>
 
 #include <fstream>
 #include <map>
@@ -8,7 +9,9 @@
 #include <sstream>
 #include <vector>
 #include <variant>
+#include <optional>
 #include <iomanip>
+#include <limits>
 #include <csignal>
 #include <cstdlib>
 #include <cerrno>
@@ -30,17 +33,27 @@
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Clou/Clou.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/IntrinsicInst.h>
 
 #include <err.h>
 
 #include "clou/MinCutGreedy.h"
+#include "clou/MinCutPortfolio.h"
+#include "clou/Capacity.h"
+#ifdef HAVE_Z3
+# include "clou/MinCutSMT.h"
+#endif
 #include "clou/util.h"
 #include "clou/Transmitter.h"
 #include "clou/CommandLine.h"
@@ -50,9 +63,12 @@
 #include "clou/analysis/SpeculativeTaintAnalysis.h"
 #include "clou/analysis/ConstantAddressAnalysis.h"
 #include "clou/analysis/LeakAnalysis.h"
+#include "clou/analysis/DenseNumberingAnalysis.h"
 #include "clou/Stat.h"
 #include "clou/containers.h"
 #include "clou/CFG.h"
+#include "clou/CutCache.h"
+#include "clou/FenceProfile.h"
 
 #ifdef HAVE_LIBPROFILER
 # include <gperftools/profiler.h>
@@ -61,10 +77,10 @@
 namespace clou {
   namespace {
 
-    static std::ofstream openFile(const llvm::Function& F, const char *suffix) {
+    static std::ofstream openFile(const llvm::Function& F, const char *suffix, const std::string& dir = ClouLogDir) {
       std::string path;
       llvm::raw_string_ostream path_os(path);
-      path_os << ClouLogDir << "/";
+      path_os << dir << "/";
       {
 	char *source_path = ::strdup(F.getParent()->getSourceFileName().c_str());
 	char *source_file = ::basename(source_path);
@@ -126,6 +142,152 @@ namespace clou {
       llvm::cl::desc("Log execution times of Mitigate Pass"),
     };
 
+    llvm::cl::opt<std::string> dump_min_cut_dir {
+      "clou-dump-min-cut",
+      llvm::cl::desc("Directory to dump each function's min-cut instance to, for replaying outside of a compile"),
+    };
+
+    llvm::cl::opt<double> function_budget {
+      "clou-min-cut-function-budget",
+      llvm::cl::desc("Wall-clock seconds to spend improving each function's min cut before settling for the best found (0 is unlimited)"),
+      llvm::cl::init(0),
+    };
+
+    llvm::cl::opt<double> module_budget {
+      "clou-min-cut-module-budget",
+      llvm::cl::desc("Wall-clock seconds to spend improving min cuts across a module (0 is unlimited)"),
+      llvm::cl::init(0),
+    };
+
+    llvm::cl::opt<unsigned> min_cut_oracle {
+      "clou-min-cut-oracle",
+      llvm::cl::desc("Also solve the min cut of functions with at most this many instructions exactly with Z3, and log how far the greedy cut is from optimal (0 disables)"),
+      llvm::cl::init(0),
+    };
+
+    llvm::cl::opt<unsigned> min_cut_oracle_timeout {
+      "clou-min-cut-oracle-timeout",
+      llvm::cl::desc("Milliseconds to give Z3 per function in -clou-min-cut-oracle mode"),
+      llvm::cl::init(60000),
+    };
+
+    enum class EdgeWeights {
+      Static,
+      Frequency,
+    };
+
+    llvm::cl::opt<EdgeWeights> edge_weights {
+      "clou-edge-weights",
+      llvm::cl::desc("What min-cut edge weights model"),
+      llvm::cl::init(EdgeWeights::Static),
+      llvm::cl::values(clEnumValN(EdgeWeights::Static, "static", "Loop nesting depth if graph weighting is on, else 1"),
+		       clEnumValN(EdgeWeights::Frequency, "frequency", "Estimated executions per function entry, from block frequencies and branch probabilities (profile metadata, if present)")),
+    };
+
+    llvm::cl::opt<std::string> fence_profile_path {
+      "clou-fence-profile",
+      llvm::cl::desc("Fence execution profile to weight min-cut edges with (written by a TracePass build run with CLOU_FENCE_PROFILE=<file>)"),
+    };
+
+    llvm::cl::opt<double> fence_profile_weight {
+      "clou-fence-profile-weight",
+      llvm::cl::desc("Min-cut cost of one profiled fence execution, relative to an edge that runs once per call"),
+      llvm::cl::init(1.),
+    };
+
+    // Loaded once per process, along with a fingerprint of its counts for the cut-cache key.
+    std::optional<FenceProfile> fence_profile;
+    std::string fence_profile_fingerprint;
+
+    void loadFenceProfile() {
+      if (fence_profile || fence_profile_path.empty())
+	return;
+      std::ifstream is(fence_profile_path);
+      if (!is)
+	err(EXIT_FAILURE, "open: %s", fence_profile_path.c_str());
+      fence_profile.emplace();
+      if (!fence_profile->read(is))
+	errx(EXIT_FAILURE, "%s: malformed fence profile", fence_profile_path.c_str());
+      // The cache outlives this process, so this must be a stable hash, unlike llvm::hash_code.
+      std::ostringstream os;
+      fence_profile->write(os);
+      llvm::SHA1 hash;
+      hash.update(os.str());
+      fence_profile_fingerprint = llvm::toHex(hash.final(), /*LowerCase*/ true);
+    }
+
+    enum class OracleEncoding {
+      Set,
+      BV,
+      CEGAR,
+    };
+
+    llvm::cl::opt<OracleEncoding> min_cut_oracle_encoding {
+      "clou-min-cut-oracle-encoding",
+      llvm::cl::desc("Z3 encoding used by -clou-min-cut-oracle"),
+      llvm::cl::init(OracleEncoding::CEGAR),
+      llvm::cl::values(clEnumValN(OracleEncoding::Set, "set", "Array-theory taint sets, all STs up front"),
+		       clEnumValN(OracleEncoding::BV, "bv", "Bit-vector taint sets, all STs up front"),
+		       clEnumValN(OracleEncoding::CEGAR, "cegar", "Bit-blasted taint, STs added as counterexamples")),
+    };
+
+    enum class MinCutBackend {
+      GreedyDinic,
+      GreedyFordFulkerson,
+      Exact,
+    };
+
+    llvm::cl::list<MinCutBackend> min_cut_portfolio {
+      "clou-min-cut-portfolio",
+      llvm::cl::desc("Race these min-cut backends on each function, keeping the lightest valid cut (default: greedy alone)"),
+      llvm::cl::CommaSeparated,
+      llvm::cl::values(clEnumValN(MinCutBackend::GreedyDinic, "greedy-dinic", "Greedy with Dinic max flow"),
+		       clEnumValN(MinCutBackend::GreedyFordFulkerson, "greedy-ford-fulkerson", "Greedy with Ford-Fulkerson max flow"),
+		       clEnumValN(MinCutBackend::Exact, "exact", "Z3 (requires building with Z3)")),
+    };
+
+    llvm::cl::opt<unsigned> min_cut_portfolio_exact_timeout {
+      "clou-min-cut-portfolio-exact-timeout",
+      llvm::cl::desc("Milliseconds to give the exact backend of -clou-min-cut-portfolio when there is no min-cut budget"),
+      llvm::cl::init(10000),
+    };
+
+    enum class HierarchicalMode {
+      Off,
+      On,
+      Verify,
+    };
+
+    llvm::cl::opt<HierarchicalMode> hierarchical_min_cut {
+      "clou-min-cut-hierarchical",
+      llvm::cl::desc("Solve the min cut on the basic-block graph first, then refine it on the instruction graph"),
+      llvm::cl::init(HierarchicalMode::Off),
+      llvm::cl::values(clEnumValN(HierarchicalMode::Off, "off", "Solve on the instruction graph only"),
+		       clEnumValN(HierarchicalMode::On, "on", "Solve on blocks, then refine"),
+		       clEnumValN(HierarchicalMode::Verify, "verify", "Also solve on the instruction graph, log both fence counts, and keep the flat cut if the hierarchical one is out of tolerance")),
+    };
+
+    llvm::cl::opt<double> hierarchical_min_cut_tolerance {
+      "clou-min-cut-hierarchical-tolerance",
+      llvm::cl::desc("In -clou-min-cut-hierarchical=verify mode, the fraction by which the hierarchical cut may have more fences than the flat cut"),
+      llvm::cl::init(0.1),
+    };
+
+    enum class BackEdgeModel {
+      Clique,
+      Hub,
+      Verify,
+    };
+    
+    llvm::cl::opt<BackEdgeModel> back_edge_model {
+      "clou-back-edges",
+      llvm::cl::desc("How exits re-entering the function are modeled in the S-CFG"),
+      llvm::cl::init(BackEdgeModel::Hub),
+      llvm::cl::values(clEnumValN(BackEdgeModel::Clique, "clique", "An edge from every exit to every entry"),
+		       clEnumValN(BackEdgeModel::Hub, "hub", "Exits and entries joined through a single hub node"),
+		       clEnumValN(BackEdgeModel::Verify, "verify", "Use the hub and check that the clique gives the same fences")),
+    };
+
     static void handle_timeout(int sig) {
       (void) sig;
       assert(sig == SIGALRM);
@@ -166,6 +328,17 @@ namespace clou {
       llvm::Value *V;
       Node() {}
       Node(llvm::Instruction *V): V(V) {}
+
+      // The node that all exits and entries of F are joined through in the hub back-edge model.
+      static Node hub(llvm::Function& F) {
+	Node v;
+	v.V = &F;
+	return v;
+      }
+      bool isHub() const {
+	return llvm::isa<llvm::Function>(V);
+      }
+
       bool operator<(const Node& o) const {
 	return V < o.V;
       }
@@ -196,27 +369,28 @@ namespace clou {
     using Edge = Alg::Edge;
     using ST = Alg::ST;
     
-    static void checkCutST(llvm::ArrayRef<std::set<Node>> st, const std::set<Edge>& cutset, llvm::Function& F) {
+    static void checkCutST(llvm::ArrayRef<std::set<Node>> st, const std::set<Edge>& cutset, llvm::Function& F,
+			   const DenseNumbering& N) {
       assert(st.size() >= 2);
       const auto succs = [&cutset] (const Node& u) {
-	std::set<Node> succs;
+	llvm::SmallVector<Node, 2> succs;
 	for (llvm::Instruction *I : llvm::successors_inst(llvm::cast<llvm::Instruction>(u.V))) {
 	  const Node v(I);
 	  const Edge e = {.src = u, .dst = v};
-	  if (!cutset.contains(e))
-	    succs.insert(v);
+	  if (!cutset.contains(e) && !llvm::is_contained(succs, v))
+	    succs.push_back(v);
 	}
 	return succs;
       };
       std::vector<std::set<Node>> particles;
-      std::vector<std::map<Node, Node>> parents;
+      std::vector<std::vector<llvm::Instruction *>> parents; // indexed by instruction id
       std::set<Node> S = st.front();
       for (const std::set<Node>& T : st.drop_front()) {
-	auto& parent = parents.emplace_back();
+	auto& parent = parents.emplace_back(N.numInstructions(), nullptr);
 	particles.push_back(S);
 	
 	// Find all nodes reachable from S.
-	std::set<Node> reach;
+	NumberedISet reach(N);
 	std::stack<Node> todo;
 
 	// Add all the successors of sources but not sources themselves in order to be able to capture cases where s = t.
@@ -227,15 +401,18 @@ namespace clou {
 	  const Node u = todo.top();
 	  todo.pop();
 	  for (const Node v : succs(u)) {
-	    if (reach.insert(v).second) {
+	    llvm::Instruction *v_I = llvm::cast<llvm::Instruction>(v.V);
+	    if (reach.insert(v_I).second) {
 	      todo.push(v);
-	      parent[v] = u;
+	      parent[N.id(v_I)] = llvm::cast<llvm::Instruction>(u.V);
 	    }
 	  }
 	}
 
 	S.clear();
-	std::set_intersection(T.begin(), T.end(), reach.begin(), reach.end(), std::inserter(S, S.end()));
+	for (const Node& t : T)
+	  if (reach.contains(llvm::cast<llvm::Instruction>(t.V)))
+	    S.insert(t);
       }
       particles.push_back(S);
 
@@ -249,7 +426,8 @@ namespace clou {
 	  Node v = t;
 	  while (true) {
 	    path.push_back(v);
-	    v = parent.at(v);
+	    v = Node(parent.at(N.id(v.V)));
+	    assert(v.V != nullptr);
 	    if (S.contains(v))
 	      break;
 	  }
@@ -303,12 +481,12 @@ namespace clou {
       }
     }
     
-    static void checkCut(llvm::ArrayRef<ST> sts, const std::set<Edge>& cutset, llvm::Function& F) {
+    static void checkCut(llvm::ArrayRef<ST> sts, const std::set<Edge>& cutset, llvm::Function& F, const DenseNumbering& N) {
       const char *s = std::getenv("CHECKCUT");
       if (s == nullptr)
 	return;
       for (const ST& st : sts)
-	checkCutST(st.waypoints, cutset, F);
+	checkCutST(st.waypoints, cutset, F, N);
     }
 
     struct MitigatePass final : public llvm::FunctionPass {
@@ -316,16 +494,117 @@ namespace clou {
     
       MitigatePass() : llvm::FunctionPass(ID) {}
 
+      // Wall-clock time spent solving min cuts in the current module, for -clou-min-cut-module-budget.
+      double module_solve_time = 0;
+
+      bool doInitialization(llvm::Module&) override {
+	module_solve_time = 0;
+	loadFenceProfile();
+	return false;
+      }
+
       void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
 	AU.addRequired<ConstantAddressAnalysis>();
 	AU.addRequired<NonspeculativeTaint>();
 	AU.addRequired<SpeculativeTaint>();
 	AU.addRequired<LeakAnalysis>();
+	AU.addRequired<DenseNumbering>();
+      }
+
+      /* Two-level min cut. The coarse graph contracts each basic block's straight-line edges, so that it has a node per
+       * block (plus the hub), and an edge between two blocks weighs as much as all the instruction edges between them.
+       * Waypoints map to their blocks. Every instruction-level path that leaves a block maps to a nonempty block-level
+       * path, so the coarse cut, mapped back to instruction edges, already cuts all of those; what it misses are paths
+       * that stay inside one block, and paths whose consecutive waypoints sit in the same block. The refinement then
+       * solves all STs on the instruction graph with the coarse cut taken out, where only such paths are left. A is
+       * left with the union of both cuts.
+       */
+      static void solveHierarchical(Alg& A, std::optional<double> budget, llvm::json::Object& log) {
+	const auto block = [] (const Node& v) -> Node {
+	  if (v.isHub())
+	    return v;
+	  return Node(&llvm::cast<llvm::Instruction>(v.V)->getParent()->front());
+	};
+
+	Alg Coarse;
+	Coarse.budget = budget;
+	std::map<Edge, std::vector<Edge>> coarse_origins;
+	for (const auto& [u, vs] : A.G) {
+	  const Node bu = block(u);
+	  Coarse.G[bu];
+	  for (const auto& [v, w] : vs) {
+	    const Node bv = block(v);
+	    if (bu == bv)
+	      continue;
+	    Capacity& cw = Coarse.G[bu][bv];
+	    cw = merge_capacities(cw, w);
+	    coarse_origins[{.src = bu, .dst = bv}].push_back({.src = u, .dst = v});
+	  }
+	}
+	for (const ST& st : A.get_sts()) {
+	  std::vector<std::set<Node>> waypoints;
+	  for (const auto& group : st.waypoints) {
+	    auto& coarse_group = waypoints.emplace_back();
+	    for (const Node& v : group)
+	      coarse_group.insert(block(v));
+	  }
+	  Coarse.add_st_list(std::move(waypoints));
+	}
+	const auto coarse_start = std::chrono::steady_clock::now();
+	Coarse.run();
+
+	// Both stages share the budget: the refinement gets whatever the coarse solve left over.
+	if (budget) {
+	  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - coarse_start).count();
+	  A.budget = std::max(*budget - elapsed, 0.);
+	}
+
+	// Take the coarse cut out of the instruction graph and refine.
+	std::vector<Edge> precut;
+	uint64_t precut_weight = 0;
+	for (const Edge& ce : Coarse.cut_edges) {
+	  for (const Edge& e : coarse_origins.at(ce)) {
+	    auto& dsts = A.G.at(e.src);
+	    precut_weight = saturating_add(precut_weight, dsts.at(e.dst));
+	    precut.push_back(e);
+	  }
+	}
+	std::map<Edge, Capacity> removed;
+	for (const Edge& e : precut) {
+	  auto& dsts = A.G.at(e.src);
+	  removed.emplace(e, dsts.at(e.dst));
+	  dsts.erase(e.dst);
+	}
+	A.run();
+	for (const auto& [e, w] : removed)
+	  A.G[e.src][e.dst] = w;
+
+	log["min_cut_hierarchical_blocks"] = Coarse.G.size();
+	log["min_cut_hierarchical_coarse_cut"] = precut.size();
+	log["min_cut_hierarchical_refined_cut"] = A.cut_edges.size();
+	llvm::copy(precut, std::back_inserter(A.cut_edges));
+	A.quality.weight = saturating_add(A.quality.weight, precut_weight);
+	A.quality.lower_bound = 0; // neither stage's bound is a bound on the instruction graph as a whole
+	A.quality.converged &= Coarse.quality.converged;
+	A.quality.budget_exhausted |= Coarse.quality.budget_exhausted;
       }
 
-      static unsigned compute_edge_weight([[maybe_unused]] llvm::Instruction *src, llvm::Instruction *dst, [[maybe_unused]] const llvm::DominatorTree& DT, const llvm::LoopInfo& LI) {
-	if (WeightGraph) {
-	  float score = 1.;
+      /* Computed in double and converted to fixed point by to_capacity(), which saturates: with deep loop nests and a high
+       * LoopWeight, the score easily exceeds what fits in 32 bits, and a wrapped weight would make hot edges look cheap.
+       * With -clou-edge-weights=frequency, BFI is given and the weight is instead how often the edge is expected to run
+       * per call, so that the min cut minimizes dynamic fence executions.
+       */
+      static Capacity compute_edge_weight([[maybe_unused]] llvm::Instruction *src, llvm::Instruction *dst, [[maybe_unused]] const llvm::DominatorTree& DT, const llvm::LoopInfo& LI,
+					  const llvm::BlockFrequencyInfo *BFI = nullptr, const llvm::BranchProbabilityInfo *BPI = nullptr) {
+	if (BFI) {
+	  llvm::BasicBlock *src_B = src->getParent();
+	  llvm::BasicBlock *dst_B = dst->getParent();
+	  llvm::BlockFrequency freq = BFI->getBlockFreq(src_B);
+	  if (src->isTerminator())
+	    freq *= BPI->getEdgeProbability(src_B, dst_B);
+	  return to_capacity(static_cast<double>(freq.getFrequency()) / BFI->getEntryFreq());
+	} else if (WeightGraph) {
+	  double score = 1.;
 #if 1
 	  const unsigned LoopDepth = std::min(instruction_loop_nest_depth(src, LI), instruction_loop_nest_depth(dst, LI));
 # if 0
@@ -337,9 +616,9 @@ namespace clou {
 	  const unsigned LoopDepth = instruction_loop_nest_depth(dst, LI);
 	  const unsigned DomDepth = instruction_dominator_depth(dst, DT);
 #endif
-	  score *= pow(LoopDepth + 1, LoopWeight);
-	  score *= 1. / pow(DomDepth + 1, DominatorWeight);
-	  return score * 1000;
+	  score *= std::pow(LoopDepth + 1, LoopWeight);
+	  score *= 1. / std::pow(DomDepth + 1, DominatorWeight);
+	  return to_capacity(score);
 	} else {
 	  return 1;
 	}
@@ -403,13 +682,14 @@ namespace clou {
 	}
       }
 
-      static std::set<llvm::Instruction *> getSourcesForNCAAccess(llvm::Instruction *I,
-								  [[maybe_unused]] const std::set<llvm::StoreInst *>& nca_pub_stores) {
+      static SmallISet getSourcesForNCAAccess(llvm::Instruction *I,
+					      [[maybe_unused]] const std::set<llvm::StoreInst *>& nca_pub_stores,
+					      const DenseNumbering& N) {
 	assert(I != &I->getFunction()->front().front() && "I cannot be the entrypoint instruction of the function");
 	// compute reach set
 	// NOTE: We specifically don't count the first instruction `I` as reaching itself in step 0.
 	// For `I` to be reached, there must be a cycle I -> I in the CFG.
-	std::set<llvm::Instruction *> reach;
+	NumberedISet reach(N);
 	{
 	  std::stack<llvm::Instruction *> todo;
 	  todo.push(I);
@@ -424,51 +704,47 @@ namespace clou {
 	}
 
 	// compute candidate sources
-	std::set<llvm::Instruction *> sources;
+	std::vector<llvm::Instruction *> sources;
 
 	// Type 1: values used to compute address.
 	for (llvm::Value *op_V : get_incoming_loads(util::getPointerOperand(I))) {
 	  if (auto *op_I = llvm::dyn_cast<llvm::Instruction>(op_V)) {
-	    sources.insert(op_I);
+	    if (reach.contains(op_I))
+	      sources.push_back(op_I);
 	  } else if (llvm::isa<llvm::Argument>(op_V)) {
 	    auto *EntryInst = &I->getFunction()->front().front();
 	    assert(I != EntryInst);
 	    assert(reach.contains(EntryInst));
-	    sources.insert(EntryInst);
+	    sources.push_back(EntryInst);
 	  } else {
 	    unhandled_value(*op_V);
 	  }
 	}
 
-	// Type 2: Control-flow.
-	// TODO: Can use more optimal analysis of control-equivalent uses of base pointer.
 	for (auto *T : reach) {
+	  // Type 2: Control-flow.
+	  // TODO: Can use more optimal analysis of control-equivalent uses of base pointer.
 	  if (T->isTerminator()) {
 	    const bool unreachable_succ = llvm::any_of(llvm::successors_inst(T), [&reach] (auto *succ) {
 	      return !reach.contains(succ);
 	    });
 	    if (unreachable_succ)
-	      sources.insert(T);
+	      sources.push_back(T);
 	  }
-	}
 
-	// Type 3: Calls.
-	for (auto *I : reach)
-	  if (auto *C = llvm::dyn_cast<llvm::CallBase>(I))
+	  // Type 3: Calls.
+	  if (auto *C = llvm::dyn_cast<llvm::CallBase>(T))
 	    if (util::mayLowerToFunctionCall(*C))
-	      sources.insert(C);
-	
-	std::erase_if(sources, [&reach] (llvm::Instruction *I) {
-	  return !reach.contains(I);
-	});
+	      sources.push_back(C);
+	}
 
 	// Also do backward frontier
-	std::set<llvm::Instruction *> actual_sources;
+	SmallISet actual_sources;
 #if 0
 	// We will hopefully do this in the ST optimizations in MinCut.
 	util::getFrontierBwd(I, sources, actual_sources);
 #else
-	actual_sources = std::move(sources);
+	actual_sources = SmallISet(sources.begin(), sources.end());
 #endif
 	
 	return actual_sources;
@@ -568,6 +844,28 @@ namespace clou {
 	j["does_not_recurse"] = F.doesNotRecurse();
       }
 
+      // Everything besides the IR that the cut depends on, for the min-cut cache key.
+      static std::string getCutCacheOptions() {
+	std::string s;
+	llvm::raw_string_ostream os(s);
+	os << "enabled " << enabled.ncas_xmit << enabled.ncas_ctrl << enabled.ncal_xmit << enabled.ncal_glob
+	   << enabled.entry_xmit << enabled.load_xmit << enabled.call_xmit << "\n"
+	   << "weights " << WeightGraph << " " << LoopWeight << " " << DominatorWeight << " "
+	   << static_cast<int>(edge_weights.getValue()) << "\n"
+	   << "fence-profile " << fence_profile_fingerprint << " " << fence_profile_weight << "\n"
+	   << "flags " << ExpandSTs << NCASAll << UnsafeAA << StrictCallingConv << "\n"
+	   << "timeout " << clou::Timeout << "\n"
+	   << "back-edges " << static_cast<int>(back_edge_model.getValue()) << "\n"
+	   << "hierarchical " << static_cast<int>(hierarchical_min_cut.getValue()) << " " << hierarchical_min_cut_tolerance << "\n"
+	   << "min-cut " << static_cast<int>(max_flow_algorithm) << " " << condense_min_cut_graph << " " << subsume_min_cut_sts << " "
+	   << min_cut_threads << " " << min_cut_batch << "\n"
+	   << "portfolio " << min_cut_portfolio_exact_timeout;
+	for (const MinCutBackend backend : min_cut_portfolio)
+	  os << " " << static_cast<int>(backend);
+	os << "\n";
+	return os.str();
+      }
+
       void saveLog(llvm::json::Object&& j, llvm::Function& F) {
 	if (!ClouLog)
 	  return;
@@ -591,6 +889,12 @@ namespace clou {
 	
 	llvm::DominatorTree DT(F);
 	llvm::LoopInfo LI(DT);
+	std::optional<llvm::BranchProbabilityInfo> BPI;
+	std::optional<llvm::BlockFrequencyInfo> BFI;
+	if (edge_weights == EdgeWeights::Frequency) {
+	  BPI.emplace(F, LI, nullptr, &DT);
+	  BFI.emplace(F, *BPI, LI);
+	}
 
 	// Set of speculatively public loads	
 	std::set<llvm::LoadInst *> spec_pub_loads;
@@ -659,6 +963,8 @@ namespace clou {
 	
 	/* Stats */
 	llvm::json::Object log;
+	if (BFI)
+	  log["edge_weights_profiled"] = F.hasProfileData(); // rather than estimated statically
 
 	CountStat stat_ncas_xmit(log, "sts_ncas_xmit");
 	CountStat stat_ncas_ctrl(log, "sts_ncas_ctrl");
@@ -780,11 +1086,12 @@ namespace clou {
 	  return nodes;
 	};
 
-	std::map<llvm::Instruction *, std::set<llvm::Instruction *>> sources_map;
-	const auto get_sources = [&] (llvm::Instruction *ncal) -> const std::set<llvm::Instruction *>& {
+	const DenseNumbering& N = getAnalysis<DenseNumbering>();
+	std::map<llvm::Instruction *, SmallISet> sources_map;
+	const auto get_sources = [&] (llvm::Instruction *ncal) -> const SmallISet& {
 	  auto it = sources_map.find(ncal);
 	  if (it == sources_map.end()) {
-	    auto sources = getSourcesForNCAAccess(ncal, nca_pub_stores);
+	    auto sources = getSourcesForNCAAccess(ncal, nca_pub_stores, N);
 	    it = sources_map.emplace(ncal, std::move(sources)).first;
 	  }
 	  return it->second; 
@@ -816,13 +1123,13 @@ namespace clou {
 	      util::getFrontierBwd(SI, all_sources, sources);
 	    }
 #elif 0
-	    const auto sources = getSourcesForNCAAccess(SI, nca_pub_stores);
+	    const auto sources = getSourcesForNCAAccess(SI, nca_pub_stores, N);
 #endif
 	    
 	    // Find instructions that the store may reach.
 	    std::stack<llvm::Instruction *> todo;
 	    todo.push(SI);
-	    std::set<llvm::Instruction *> seen;
+	    NumberedISet seen(N);
 	    while (!todo.empty()) {
 	      llvm::Instruction *I = todo.top();
 	      todo.pop();
@@ -1066,10 +1373,15 @@ namespace clou {
 	  for (auto& src : B) {
 	    auto& dsts = G[&src];
 	    for (auto *dst : llvm::successors_inst(&src))
-	      dsts[dst] = compute_edge_weight(&src, dst, DT, LI);
+	      dsts[dst] = compute_edge_weight(&src, dst, DT, LI, BFI ? &*BFI : nullptr, BPI ? &*BPI : nullptr);
 	  }
 	}
 
+	// Hub back-edge model: the clique edges each hub edge stands for.
+	std::map<Node, std::vector<Node>> hub_succs, hub_preds; // clique edges, keyed by exit and by entry
+	std::map<Node, std::vector<Node>> clique_preds; // clique edges by entry, in any back-edge model
+	std::optional<Alg> CliqueA; // for -clou-back-edges=verify
+
 #if 0
 	// Add back edges to CFG
 	for (llvm::ReturnInst& RI : util::instructions<llvm::ReturnInst>(F)) {
@@ -1078,30 +1390,201 @@ namespace clou {
 	}
 #else
 	// Add all back edges to the S-CFG.
+	/* The clique has an edge from every exit to every entry, i.e., O(calls^2) edges. The hub model instead joins them
+	 * through a single node: exit -> hub weighs as much as all of that exit's clique edges and hub -> entry as much as
+	 * all of that entry's, so that cutting either costs the same as cutting the corresponding clique edges. Afterwards,
+	 * cut hub edges are mapped back to clique edges, whose mitigation point is always the entry.
+	 */
 	{
-	  const auto exits = llvm::make_filter_range(llvm::instructions(F), [] (const llvm::Instruction& I) {
+	  std::vector<llvm::Instruction *> exits, entries;
+	  for (llvm::Instruction& I : llvm::instructions(F)) {
 	    if (llvm::isa<llvm::ReturnInst>(&I))
-	      return true;
-	    if (auto *C = llvm::dyn_cast<llvm::CallBase>(&I))
-	      return util::mayLowerToFunctionCall(*C);
-	    return false;
-	  });
-	  const auto entries = llvm::make_filter_range(llvm::instructions(F), [] (const llvm::Instruction& I) {
-	    if (&I == &I.getFunction()->front().front())
-	      return true;
-	    if (auto *C = llvm::dyn_cast_or_null<llvm::CallBase>(I.getPrevNode()))
+	      exits.push_back(&I);
+	    else if (auto *C = llvm::dyn_cast<llvm::CallBase>(&I))
 	      if (util::mayLowerToFunctionCall(*C))
-		return true;
-	    return false;
-	  });
+		exits.push_back(&I);
+	    if (&I == &F.front().front())
+	      entries.push_back(&I);
+	    else if (auto *C = llvm::dyn_cast_or_null<llvm::CallBase>(I.getPrevNode()))
+	      if (util::mayLowerToFunctionCall(*C))
+		entries.push_back(&I);
+	  }
 
-	  for (auto& exit : exits)
-	    for (auto& entry : entries)
-	      if (&entry != &exit)
-		G[&exit].emplace(&entry, 1); // NOTE: We intentionally don't overwrite the previous value, since it may have been already added and contain a better edge weight. 
+	  // A cut clique edge is mitigated at its entry, so with frequency weights, it costs as much as the entry runs.
+	  const auto back_edge_weight = [&] (const Node& entry) -> Capacity {
+	    if (!BFI)
+	      return 1;
+	    const llvm::BasicBlock *B = llvm::cast<llvm::Instruction>(entry.V)->getParent();
+	    return to_capacity(static_cast<double>(BFI->getBlockFreq(B).getFrequency()) / BFI->getEntryFreq());
+	  };
+
+	  const auto add_clique = [&] (Alg::Graph& G) {
+	    for (llvm::Instruction *exit : exits)
+	      for (llvm::Instruction *entry : entries)
+		if (entry != exit)
+		  G[exit].emplace(entry, back_edge_weight(entry)); // NOTE: We intentionally don't overwrite the previous value, since it may have been already added and contain a better edge weight. 
+	  };
+
+	  // Only exit-entry pairs that aren't already CFG edges get a clique edge.
+	  for (llvm::Instruction *exit : exits) {
+	    const auto exit_it = G.find(exit);
+	    for (llvm::Instruction *entry : entries)
+	      if (entry != exit && (exit_it == G.end() || !exit_it->second.contains(entry)))
+		clique_preds[entry].push_back(exit);
+	  }
+
+	  if (back_edge_model == BackEdgeModel::Clique) {
+	    add_clique(G);
+	  } else {
+	    if (back_edge_model == BackEdgeModel::Verify) {
+	      CliqueA.emplace(A);
+	      add_clique(CliqueA->G);
+	    }
+	    
+	    hub_preds = clique_preds;
+	    for (const auto& [entry, preds] : hub_preds)
+	      for (const Node& exit : preds)
+		hub_succs[exit].push_back(entry);
+	    const Node hub = Node::hub(F);
+	    for (const auto& [exit, succs] : hub_succs) {
+	      Capacity& w = G[exit][hub];
+	      w = 0;
+	      for (const Node& entry : succs)
+		w = merge_capacities(w, back_edge_weight(entry));
+	    }
+	    for (const auto& [entry, preds] : hub_preds)
+	      G[hub][entry] = std::min(saturating_mul<Capacity>(back_edge_weight(entry), preds.size()), max_capacity);
+	  }
 	}
 #endif
 
+	/* Profile-guided weights. An edge whose fence ran n times in the profiled build costs at least n times
+	 * -clou-fence-profile-weight, so that the cut moves off edges that turned out to be hot; other edges keep their
+	 * static weight. The fences of all clique edges into an entry sit at the entry, so each of them, and the hub -> entry
+	 * edge that stands for them, costs as much as all of them ran. An exit -> hub edge costs as much as all the entries
+	 * that cutting it fences.
+	 */
+	if (fence_profile) {
+	  // Without debug info, edges can't be told apart by their descriptions, so the profile can't say which ran.
+	  static bool warned_no_debug_info = false;
+	  if (!F.getSubprogram() && !warned_no_debug_info) {
+	    llvm::WithColor::warning() << F.getName() << ": no debug info; -clou-fence-profile only applies to functions "
+				       << "compiled with -g\n";
+	    warned_no_debug_info = true;
+	  }
+	  std::map<std::string, uint64_t> site_counts;
+	  for (auto it = fence_profile->counts.lower_bound({F.getName().str(), ""});
+	       it != fence_profile->counts.end() && it->first.first == F.getName(); ++it)
+	    if (FenceProfile::has_locations(it->first.second))
+	      site_counts.emplace(it->first.second, it->second);
+	  const auto lookup = [&] (const Node& src, const Node& dst) -> uint64_t {
+	    const std::string description = describeEdge(src.V, dst.V);
+	    if (!FenceProfile::has_locations(description))
+	      return 0;
+	    const auto it = site_counts.find(description);
+	    return it == site_counts.end() ? 0 : it->second;
+	  };
+	  std::map<Node, uint64_t> entry_counts;
+	  for (const auto& [entry, exits] : clique_preds) {
+	    uint64_t n = 0;
+	    for (const Node& exit : exits)
+	      n = saturating_add(n, lookup(exit, entry));
+	    if (n > 0)
+	      entry_counts.emplace(entry, n);
+	  }
+	  const auto profile_weight = [&] (uint64_t n) -> Capacity {
+	    return n > 0 ? to_capacity(n * fence_profile_weight) : 0;
+	  };
+	  const auto entry_weight = [&] (const Node& entry) -> Capacity {
+	    const auto it = entry_counts.find(entry);
+	    return it == entry_counts.end() ? 0 : profile_weight(it->second);
+	  };
+	  const auto is_clique_edge = [] (const Node& src, const Node& dst) {
+	    return !llvm::is_contained(llvm::successors_inst(llvm::cast<llvm::Instruction>(src.V)), dst.V);
+	  };
+	  const auto apply_profile = [&] (Alg::Graph& G) {
+	    unsigned profiled = 0;
+	    for (auto& [src, dsts] : G) {
+	      for (auto& [dst, w] : dsts) {
+		Capacity pw = 0;
+		if (dst.isHub()) {
+		  for (const Node& entry : hub_succs.at(src))
+		    pw = merge_capacities(pw, entry_weight(entry));
+		} else if (src.isHub() || is_clique_edge(src, dst)) {
+		  pw = entry_weight(dst);
+		} else {
+		  pw = profile_weight(lookup(src, dst));
+		}
+		if (pw > 0) {
+		  w = std::max(w, pw);
+		  ++profiled;
+		}
+	      }
+	    }
+	    return profiled;
+	  };
+	  if (!site_counts.empty()) {
+	    log["fence_profile_edges"] = apply_profile(G);
+	    if (CliqueA)
+	      apply_profile(CliqueA->G);
+	  }
+	  log["fence_profile_sites"] = site_counts.size();
+	}
+
+	// Map cut hub edges back to clique edges, with one edge per entry that needs a mitigation.
+	const auto expand_hub_edges = [&] (const std::vector<Edge>& cut_edges) {
+	  if (hub_succs.empty())
+	    return cut_edges;
+	  std::map<Node, Node> entry_cuts;
+	  std::vector<Edge> new_cut_edges;
+	  for (const Edge& e : cut_edges) {
+	    if (e.dst.isHub()) {
+	      for (const Node& entry : hub_succs.at(e.src))
+		entry_cuts.emplace(entry, e.src);
+	    } else if (e.src.isHub()) {
+	      entry_cuts.emplace(e.dst, hub_preds.at(e.dst).front());
+	    } else {
+	      new_cut_edges.push_back(e);
+	    }
+	  }
+	  for (const auto& [entry, exit] : entry_cuts)
+	    new_cut_edges.push_back({.src = exit, .dst = entry});
+	  return new_cut_edges;
+	};
+
+	// Look up the cut in the cache, whose entries already have hub edges mapped back to clique edges.
+	std::string cut_cache_key;
+	std::optional<std::vector<CutCacheEdge>> cached_cut;
+	if (!cut_cache_dir.empty()) {
+	  cut_cache_key = getCutCacheKey(F, getCutCacheOptions());
+	  cached_cut = loadCutCache(F, cut_cache_key);
+
+	  /* The key can't capture every change to how the STs are built, so check that a cached cut still separates this
+	   * compilation's STs, and solve again if it doesn't. A cached clique edge exit -> entry is fenced at the entry, which
+	   * in the hub model is the hub -> entry edge.
+	   */
+	  if (cached_cut) {
+	    std::set<Edge> cutset;
+	    bool stale = false;
+	    for (const auto& [src, dst] : *cached_cut) {
+	      const auto src_it = G.find(src);
+	      if (src_it != G.end() && src_it->second.contains(dst))
+		cutset.insert({.src = src, .dst = dst});
+	      else if (hub_preds.contains(dst))
+		cutset.insert({.src = Node::hub(F), .dst = dst});
+	      else
+		stale = true;
+	    }
+	    stale = stale || !llvm::all_of(A.get_sts(), [&] (const Alg::ST& st) { return A.separates(st, cutset); });
+	    if (stale) {
+	      llvm::WithColor::warning() << F.getName() << ": cached min cut doesn't separate all STs; solving again\n";
+	      cached_cut.reset();
+	    }
+	    log["cut_cache_stale"] = stale;
+	  }
+	  log["cut_cache_hit"] = cached_cut.has_value();
+	}
+
 	// Run algorithm to obtain min-cut
 	const clock_t solve_start = clock();
 #if 0
@@ -1109,17 +1592,183 @@ namespace clou {
 #endif
 	auto G_ = G;
 	const auto sts_bak = A.get_sts().vec();
-	std::cerr << "Min-Cut on " << F.getName().str() << std::endl;
-	A.run();
+	if (!dump_min_cut_dir.empty()) {
+	  if (::mkdir(dump_min_cut_dir.c_str(), 0770) < 0 && errno != EEXIST)
+	    err(EXIT_FAILURE, "mkdir: %s", dump_min_cut_dir.c_str());
+	  std::ofstream f = openFile(F, ".mincut", dump_min_cut_dir);
+	  llvm::raw_os_ostream os(f);
+	  A.instance(F.getName().str()).write(os);
+	}
+	if (cached_cut) {
+	  for (const auto& [src, dst] : *cached_cut)
+	    A.cut_edges.push_back({.src = src, .dst = dst});
+	} else {
+	  std::optional<double> budget;
+	  if (function_budget > 0)
+	    budget = function_budget;
+	  if (module_budget > 0)
+	    budget = std::min(budget.value_or(module_budget), std::max(module_budget - module_solve_time, 0.));
+	  A.budget = budget;
+	  
+	  std::cerr << "Min-Cut on " << F.getName().str() << std::endl;
+	  const auto wall_start = std::chrono::steady_clock::now();
+	  std::optional<MinCutPortfolio<Node>> P;
+	  if (!min_cut_portfolio.empty()) {
+	    P.emplace();
+	    P->G = G;
+	    for (const Alg::ST& st : A.get_sts())
+	      P->add_st_list(st.waypoints);
+	    P->budget = budget;
+	    for (const MinCutBackend backend : min_cut_portfolio) {
+	      switch (backend) {
+	      case MinCutBackend::GreedyDinic:
+	      case MinCutBackend::GreedyFordFulkerson: {
+		auto Greedy = std::make_unique<Alg>();
+		Greedy->budget = budget;
+		Greedy->algorithm = backend == MinCutBackend::GreedyDinic ? MaxFlowAlgorithm::Dinic : MaxFlowAlgorithm::FordFulkerson;
+		const Alg *GreedyP = Greedy.get();
+		P->add(backend == MinCutBackend::GreedyDinic ? "greedy-dinic" : "greedy-ford-fulkerson", std::move(Greedy),
+		       [GreedyP] { return GreedyP->quality.converged; });
+		break;
+	      }
+	      case MinCutBackend::Exact: {
+#ifdef HAVE_Z3
+		auto Exact = std::make_unique<MinCutSMT_CEGAR<Node, Capacity>>();
+		Exact->timeout_ms = budget ? static_cast<unsigned>(*budget * 1000) : min_cut_portfolio_exact_timeout;
+		const auto *ExactP = Exact.get();
+		P->add("exact", std::move(Exact), [ExactP] { return ExactP->optimal; }, /*exact*/ true);
+#else
+		llvm::WithColor::warning() << "-clou-min-cut-portfolio=exact requires building with Z3; ignoring\n";
+#endif
+		break;
+	      }
+	      }
+	    }
+	    P->run();
+	  }
+	  if (P && P->winner) {
+	    const auto& winner = P->outcomes[*P->winner];
+	    A.cut_edges = P->cut_edges;
+	    A.quality = {.weight = winner.weight, .converged = winner.complete, .budget_exhausted = budget && !winner.complete};
+	  } else if (hierarchical_min_cut != HierarchicalMode::Off) {
+	    std::optional<Alg> FlatA;
+	    if (hierarchical_min_cut == HierarchicalMode::Verify)
+	      FlatA.emplace(A);
+	    solveHierarchical(A, budget, log);
+	    if (FlatA) {
+	      FlatA->run();
+	      const size_t flat_fences = getMitigationSites(expand_hub_edges(FlatA->cut_edges)).size();
+	      const size_t fences = getMitigationSites(expand_hub_edges(A.cut_edges)).size();
+	      const double excess = flat_fences > 0 ? static_cast<double>(fences) / flat_fences - 1 : fences > 0;
+	      log["min_cut_flat_fences"] = flat_fences;
+	      log["min_cut_hierarchical_fences"] = fences;
+	      log["min_cut_hierarchical_excess"] = excess;
+	      const bool within = excess <= hierarchical_min_cut_tolerance;
+	      log["min_cut_hierarchical_within_tolerance"] = within;
+	      if (!within) {
+		llvm::WithColor::warning() << F.getName() << ": hierarchical min cut has " << fences << " fences, versus "
+					   << flat_fences << " flat; using the flat cut\n";
+		A.cut_edges = std::move(FlatA->cut_edges);
+		A.quality = FlatA->quality;
+	      }
+	    }
+	  } else {
+	    A.run();
+	  }
+	  module_solve_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+	  if (P) {
+	    auto& outcomes = log["min_cut_portfolio"] = llvm::json::Array();
+	    for (const auto& outcome : P->outcomes) {
+	      outcomes.getAsArray()->push_back(llvm::json::Object {
+		  {"backend", outcome.name},
+		  {"finished", outcome.finished},
+		  {"valid", outcome.valid},
+		  {"complete", outcome.complete},
+		  {"weight", static_cast<int64_t>(outcome.weight)},
+		  {"seconds", outcome.seconds},
+		});
+	    }
+	    if (P->winner)
+	      log["min_cut_portfolio_winner"] = P->outcomes[*P->winner].name;
+	    else
+	      log["min_cut_portfolio_winner"] = nullptr;
+	  }
+
+#ifdef HAVE_Z3
+	  // Exact solve of the same problem, to measure the greedy's gap.
+	  if (F.getInstructionCount() <= min_cut_oracle) {
+	    const auto solve_exact = [&] (auto&& Oracle) -> std::optional<uint64_t> {
+	      Oracle.G = G_;
+	      for (const Alg::ST& st : sts_bak)
+		Oracle.add_st_list(st.waypoints);
+	      Oracle.timeout_ms = min_cut_oracle_timeout;
+	      Oracle.run();
+	      if (!Oracle.optimal)
+		return std::nullopt;
+	      return Oracle.optimal_weight;
+	    };
+	    std::optional<uint64_t> optimal_weight;
+	    switch (min_cut_oracle_encoding) {
+	    case OracleEncoding::Set:
+	      optimal_weight = solve_exact(MinCutSMT_Set<Node, Capacity>());
+	      break;
+	    case OracleEncoding::BV:
+	      optimal_weight = solve_exact(MinCutSMT_BV<Node, Capacity>());
+	      break;
+	    case OracleEncoding::CEGAR:
+	      optimal_weight = solve_exact(MinCutSMT_CEGAR<Node, Capacity>());
+	      break;
+	    }
+	    if (optimal_weight) {
+	      log["min_cut_optimal_weight"] = static_cast<int64_t>(*optimal_weight);
+	      log["min_cut_greedy_ratio"] = *optimal_weight > 0 ?
+		static_cast<double>(A.quality.weight) / *optimal_weight : 1.;
+	    } else {
+	      log["min_cut_optimal_weight"] = nullptr;
+	    }
+	  }
+#endif
+
+	  log["min_cut_weight"] = static_cast<int64_t>(A.quality.weight);
+	  log["min_cut_rounds"] = A.quality.rounds;
+	  log["min_cut_converged"] = A.quality.converged;
+	  if (budget) {
+	    log["min_cut_budget"] = *budget;
+	    log["min_cut_budget_exhausted"] = A.quality.budget_exhausted;
+	    log["min_cut_lower_bound"] = static_cast<int64_t>(A.quality.lower_bound);
+	    log["min_cut_gap"] = A.quality.weight > 0 ?
+	      static_cast<double>(A.quality.weight - A.quality.lower_bound) / A.quality.weight : 0.;
+	  }
+	}
 	const clock_t solve_stop = clock();
 	const float solve_duration = (static_cast<float>(solve_stop) - static_cast<float>(solve_start)) / CLOCKS_PER_SEC;
 	auto& cut_edges = A.cut_edges;
 
+	if (!cached_cut)
+	  cut_edges = expand_hub_edges(cut_edges);
+
+	if (!cached_cut && CliqueA) {
+	  CliqueA->run();
+	  const bool same = getMitigationSites(CliqueA->cut_edges) == getMitigationSites(cut_edges);
+	  if (!same)
+	    llvm::WithColor::warning() << F.getName() << ": hub back-edge model gives different fences than the clique\n";
+	  log["back_edges_verified"] = same;
+	}
+
 	// double-check cut: make sure that no source can reach its sink
 	{
 	  std::set<Edge> cutset;
 	  llvm::copy(cut_edges, std::inserter(cutset, cutset.end()));
-	  checkCut(sts_bak, cutset, F);
+	  checkCut(sts_bak, cutset, F, getAnalysis<DenseNumbering>());
+	}
+
+	// Don't cache cuts cut short by the budget, which depend on how fast this compile happened to be.
+	if (!cut_cache_dir.empty() && !cached_cut && A.quality.converged) {
+	  std::vector<CutCacheEdge> cut;
+	  for (const auto& [src, dst] : cut_edges)
+	    cut.emplace_back(llvm::cast<llvm::Instruction>(src.V), llvm::cast<llvm::Instruction>(dst.V));
+	  saveCutCache(F, cut_cache_key, cut);
 	}
 
 	// Output DOT graph, color cut edges
@@ -1278,23 +1927,7 @@ namespace clou {
 	auto& lfence_srclocs = log["lfence_srclocs"] = llvm::json::Array();
 	for (const auto& [src, dst] : cut_edges) {
 	  if (llvm::Instruction *mitigation_point = getMitigationPoint(llvm::cast<llvm::Instruction>(src.V), llvm::cast<llvm::Instruction>(dst.V))) {
-	    std::string s;
-	    llvm::raw_string_ostream os(s);
-	    const auto print_debug_loc = [&os] (const llvm::Value *V, bool forward) {
-	      const llvm::Instruction *I = llvm::cast<llvm::Instruction>(V);
-	      llvm::DebugLoc DL;
-	      while (I != nullptr && !DL) {
-		DL = I->getDebugLoc();
-		if (forward)
-		  I = I->getNextNode();
-		else
-		  I = I->getPrevNode();
-	      }
-	      DL.print(os);
-	    };
-	    print_debug_loc(src.V, false);
-	    os << "--->";
-	    print_debug_loc(dst.V, true);
+	    const std::string s = describeEdge(src.V, dst.V);
 	    CreateMitigation(mitigation_point, s.c_str());
 	    
 	    // Print out mitigation info
@@ -1337,12 +1970,48 @@ namespace clou {
         return true;
       }
 
+      /* A mitigation's description: the source locations of the edge it sits on, "<src>---><dst>", each taken from the
+       * nearest instruction with a debug location. This is also what fence profiles are keyed by.
+       */
+      static std::string describeEdge(const llvm::Value *src, const llvm::Value *dst) {
+	std::string s;
+	llvm::raw_string_ostream os(s);
+	const auto print_debug_loc = [&os] (const llvm::Value *V, bool forward) {
+	  const llvm::Instruction *I = llvm::cast<llvm::Instruction>(V);
+	  llvm::DebugLoc DL;
+	  while (I != nullptr && !DL) {
+	    DL = I->getDebugLoc();
+	    if (forward)
+	      I = I->getNextNode();
+	    else
+	      I = I->getPrevNode();
+	  }
+	  DL.print(os);
+	};
+	print_debug_loc(src, false);
+	os << "--->";
+	print_debug_loc(dst, true);
+	return s;
+      }
+
 #if 1
       static bool shouldCutEdge([[maybe_unused]] llvm::Instruction *src, llvm::Instruction *dst) {
 	// return llvm::predecessors(dst).size() > 1 || llvm::successors_inst(src).size() > 1;
 	return llvm::predecessors(dst).size() > 1;
       }
 
+      // Where getMitigationPoint() would put each fence, without modifying the function: the edge if it would be split,
+      // otherwise just the destination.
+      static std::set<std::pair<llvm::Value *, llvm::Value *>> getMitigationSites(llvm::ArrayRef<Edge> cut_edges) {
+	std::set<std::pair<llvm::Value *, llvm::Value *>> sites;
+	for (const auto& [src, dst] : cut_edges) {
+	  auto *src_I = llvm::cast<llvm::Instruction>(src.V);
+	  auto *dst_I = llvm::cast<llvm::Instruction>(dst.V);
+	  sites.emplace(shouldCutEdge(src_I, dst_I) ? src_I : nullptr, dst_I);
+	}
+	return sites;
+      }
+
       static llvm::Instruction *getMitigationPoint(llvm::Instruction *src, llvm::Instruction *dst) {
 	if (shouldCutEdge(src, dst)) {
 	  assert(src->isTerminator());
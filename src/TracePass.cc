@@ -9,6 +9,7 @@
 
 #include "clou/util.h"
 #include "clou/Mitigation.h"
+#include "clou/FenceProfile.h"
 
 namespace clou {
   namespace {
@@ -31,7 +32,8 @@ namespace clou {
 	    const llvm::DebugLoc& DL = MI->getDebugLoc();
 	    IRB.SetCurrentDebugLocation(DL);
 
-	    const auto s = MI->getDescription();
+	    // Keyed by function too, so that the runtime's counts can be fed back into MitigatePass as a FenceProfile.
+	    const auto s = FenceProfile::key(F.getName(), MI->getDescription());
 
 	    auto *byte_array = llvm::ConstantDataArray::getString(IRB.getContext(), s, true);
 	    auto *byte_var = new llvm::GlobalVariable(M, byte_array->getType(), true, llvm::GlobalVariable::PrivateLinkage,
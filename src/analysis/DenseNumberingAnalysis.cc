@@ -0,0 +1,38 @@
+#include "clou/analysis/DenseNumberingAnalysis.h"
+
+#include <llvm/IR/InstIterator.h>
+
+namespace clou {
+
+  char DenseNumbering::ID = 0;
+  DenseNumbering::DenseNumbering(): llvm::FunctionPass(ID) {}
+
+  void DenseNumbering::getAnalysisUsage(llvm::AnalysisUsage& AU) const {
+    AU.setPreservesAll();
+  }
+
+  bool DenseNumbering::runOnFunction(llvm::Function& F) {
+    values.clear();
+    ids.clear();
+    for (llvm::Instruction& I : llvm::instructions(F)) {
+      ids[&I] = values.size();
+      values.push_back(&I);
+    }
+    num_insts = values.size();
+    for (llvm::Argument& A : F.args()) {
+      ids[&A] = values.size();
+      values.push_back(&A);
+    }
+    return false;
+  }
+
+  void DenseNumbering::print(llvm::raw_ostream& os, const llvm::Module *) const {
+    os << "Dense Numbering:\n";
+    for (unsigned id = 0; id < values.size(); ++id)
+      os << id << ": " << *values[id] << "\n";
+    os << "\n";
+  }
+
+  static llvm::RegisterPass<DenseNumbering> X {"clou-dense-numbering", "Clou's Dense Numbering of Instructions and Arguments"};
+
+}
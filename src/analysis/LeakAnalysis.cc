@@ -8,10 +8,18 @@
 #include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/Clou/Clou.h>
+#include <llvm/ADT/Statistic.h>
 
 #include "clou/Transmitter.h"
 #include "clou/CommandLine.h"
 #include "clou/containers.h"
+#include "clou/ObjectPartition.h"
+
+#define DEBUG_TYPE "clou-leak-analysis"
+
+STATISTIC(NumAliasQueries, "Number of alias queries made for aliasing stores");
+STATISTIC(NumAliasQueriesSkipped, "Number of alias queries skipped by partitioning stores by underlying object");
+STATISTIC(NumAliasingStoresComputed, "Number of load addresses whose aliasing stores were computed");
 
 namespace clou {
 
@@ -36,38 +44,51 @@ namespace clou {
     }
   }
 
+  /* The stores of a function are partitioned by underlying object up front, so that computing a load's aliasing
+   * stores only queries the candidates that may alias it. Results are memoized by the load's pointer operand, since
+   * alias queries don't depend on anything else, so repeated lookups cost only the size of the answer.
+   */
   class AliasingStores {
   public:
-    AliasingStores(llvm::AliasAnalysis& AA): AA(AA) {}
+    AliasingStores(llvm::Function& F, llvm::AliasAnalysis& AA): AA(AA) {
+      for (llvm::Instruction& Store : llvm::instructions(F)) {
+	if (!Store.mayWriteToMemory())
+	  continue;
+	if (llvm::isa<llvm::CallBase, llvm::FenceInst>(&Store))
+	  continue;
+	stores.insert(util::getPointerOperand(&Store), &Store);
+      }
+    }
 
     const ISet& getAliasingStores(llvm::Instruction *Load) {
-      Map::const_iterator it = aliases.find(Load);
+      const llvm::Value *Ptr = util::getPointerOperand(Load);
+      Map::const_iterator it = aliases.find(Ptr);
       if (it == aliases.end())
-	it = computeAliases(Load);
+	it = computeAliases(Ptr);
       return it->second; 
     }
     
   private:
     llvm::AliasAnalysis& AA;
-    using Map = std::map<llvm::Instruction *, ISet>;
+    ObjectPartition<llvm::Instruction *> stores;
+    using Map = std::map<const llvm::Value *, ISet>;
     Map aliases;
 
-    Map::const_iterator computeAliases(llvm::Instruction *Load) {
-      llvm::Function& F = *Load->getParent()->getParent();
-      assert(!aliases.contains(Load));
+    Map::const_iterator computeAliases(const llvm::Value *Ptr) {
+      assert(!aliases.contains(Ptr));
+      ++NumAliasingStoresComputed;
       ISet Stores;
-      for (llvm::Instruction& Store : llvm::instructions(F)) {
-	if (!Store.mayWriteToMemory())
-	  continue;
-	if (llvm::isa<llvm::CallBase, llvm::FenceInst>(&Store))
-	  continue;
-	const auto AR = AA.alias(util::getPointerOperand(Load), util::getPointerOperand(&Store));
-	if (isDefinitelyNoAlias(AR))
-	  continue;
-	Stores.insert(&Store);
-      }
-      const auto result = aliases.emplace(Load, std::move(Stores));
-      assert(result.second && "Alias set already computed for this load!");
+      size_t queries = 0;
+      stores.for_each_candidate(Ptr, [&] (llvm::Instruction *Store) {
+	++queries;
+	const auto AR = AA.alias(Ptr, util::getPointerOperand(Store));
+	if (!isDefinitelyNoAlias(AR))
+	  Stores.insert(Store);
+      });
+      NumAliasQueries += queries;
+      NumAliasQueriesSkipped += stores.getAll().size() - queries;
+      const auto result = aliases.emplace(Ptr, std::move(Stores));
+      assert(result.second && "Alias set already computed for this address!");
       return result.first;
     }
   };
@@ -86,7 +107,7 @@ namespace clou {
       }
     }
 
-    AliasingStores Aliases(AA);
+    AliasingStores Aliases(F, AA);
 
     VSet leaks_bak;
     do {
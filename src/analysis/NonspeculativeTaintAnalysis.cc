@@ -17,6 +17,7 @@
 #include "clou/Transmitter.h"
 #include "clou/Mitigation.h"
 #include "clou/CommandLine.h"
+#include "clou/ObjectPartition.h"
 
 namespace clou {
 
@@ -39,214 +40,248 @@ namespace clou {
     }
   }
 
+  namespace {
+    // What an instruction becoming public implies about other values.
+    enum class Rule : uint8_t {
+      None,
+      Operands, // all its operands are public
+      Args,     // all its call arguments are public
+      FirstArg, // its first call argument is public
+      Memory,   // its access operands and those of every access that must alias it are public
+    };
+  }
+
+  static Rule getIntrinsicRule(llvm::IntrinsicInst *II) {
+    switch (II->getIntrinsicID()) {
+    case llvm::Intrinsic::memset:
+    case llvm::Intrinsic::memcpy:
+    case llvm::Intrinsic::x86_sse2_lfence:
+      assert(II->getType()->isVoidTy());
+      return Rule::None;
+
+    case llvm::Intrinsic::vector_reduce_and:
+    case llvm::Intrinsic::vector_reduce_add:
+    case llvm::Intrinsic::vector_reduce_or:
+    case llvm::Intrinsic::fshl:
+    case llvm::Intrinsic::ctpop:
+    case llvm::Intrinsic::x86_aesni_aeskeygenassist:
+    case llvm::Intrinsic::x86_aesni_aesenc:
+    case llvm::Intrinsic::x86_aesni_aesenclast:
+    case llvm::Intrinsic::bswap:
+    case llvm::Intrinsic::x86_pclmulqdq:
+    case llvm::Intrinsic::umin:
+    case llvm::Intrinsic::umax:
+    case llvm::Intrinsic::smin:
+    case llvm::Intrinsic::smax:
+    case llvm::Intrinsic::abs:
+    case llvm::Intrinsic::x86_rdrand_32:
+    case llvm::Intrinsic::umul_with_overflow:
+    case llvm::Intrinsic::bitreverse:
+    case llvm::Intrinsic::cttz:
+    case llvm::Intrinsic::usub_sat:
+    case llvm::Intrinsic::fmuladd:
+    case llvm::Intrinsic::fabs:
+    case llvm::Intrinsic::experimental_constrained_fcmp:
+    case llvm::Intrinsic::experimental_constrained_fsub:
+    case llvm::Intrinsic::experimental_constrained_fmul:
+    case llvm::Intrinsic::experimental_constrained_sitofp:
+    case llvm::Intrinsic::experimental_constrained_uitofp:
+    case llvm::Intrinsic::experimental_constrained_fcmps:
+    case llvm::Intrinsic::experimental_constrained_fadd:
+    case llvm::Intrinsic::experimental_constrained_fptosi:
+    case llvm::Intrinsic::experimental_constrained_fdiv:
+    case llvm::Intrinsic::experimental_constrained_fptoui:
+    case llvm::Intrinsic::experimental_constrained_fpext:
+    case llvm::Intrinsic::experimental_constrained_floor:
+    case llvm::Intrinsic::experimental_constrained_ceil:
+    case llvm::Intrinsic::experimental_constrained_fptrunc:
+    case llvm::Intrinsic::experimental_constrained_fmuladd:
+    case llvm::Intrinsic::masked_load:
+    case llvm::Intrinsic::masked_gather:
+    case llvm::Intrinsic::stacksave:
+    case llvm::Intrinsic::fshr:
+    case llvm::Intrinsic::vector_reduce_mul:
+    case llvm::Intrinsic::vector_reduce_umax:
+    case llvm::Intrinsic::vector_reduce_umin:
+    case llvm::Intrinsic::vector_reduce_smax:
+    case llvm::Intrinsic::vector_reduce_smin:
+    case llvm::Intrinsic::vector_reduce_xor:
+    case llvm::Intrinsic::eh_typeid_for:
+    case llvm::Intrinsic::uadd_with_overflow:
+    case llvm::Intrinsic::ctlz:
+    case llvm::Intrinsic::experimental_constrained_powi:
+    case llvm::Intrinsic::experimental_constrained_trunc:
+    case llvm::Intrinsic::experimental_constrained_round:
+    case llvm::Intrinsic::uadd_sat:
+      return Rule::Args;
+
+    case llvm::Intrinsic::annotation:
+      return Rule::FirstArg;
+
+    default:
+      warn_unhandled_intrinsic(II);
+      return Rule::None;
+    }
+  }
+
   bool NonspeculativeTaint::runOnFunction(llvm::Function& F) {
-    pub_vals.clear();
     this->F = &F;
+    values.clear();
+    ids.clear();
     
     llvm::AAResults& AA = getAnalysis<llvm::AAResultsWrapperPass>().getAAResults();
 
-    // Initialize public values with transmitter operands. We'll handle call results in the main loop.
+    /* Number every value that can become public, instructions first so that they can index per-instruction vectors,
+     * and solve with a worklist: an instruction is only visited once, when it becomes public, to publish whatever
+     * that implies. Rules that don't depend on publicity are applied up front.
+     */
+    const auto number = [&] (llvm::Value *V) {
+      if (ids.try_emplace(V, values.size()).second)
+	values.push_back(V);
+    };
+    for (llvm::Instruction& I : llvm::instructions(F))
+      number(&I);
+    const unsigned num_insts = values.size();
+    for (llvm::Argument& A : F.args())
+      number(&A);
+    for (llvm::Instruction& I : llvm::instructions(F))
+      for (llvm::Value *op_V : I.operands())
+	number(op_V);
+    pub_vals.clear();
+    pub_vals.resize(values.size());
+
+    std::vector<Rule> rules(num_insts, Rule::None);
+    std::vector<unsigned> worklist;
+    const auto publish = [&] (llvm::Value *V) {
+      if (V == nullptr)
+	return;
+      const auto it = ids.find(V);
+      assert(it != ids.end());
+      const unsigned id = it->second;
+      if (pub_vals.test(id))
+	return;
+      pub_vals.set(id);
+      if (id < num_insts && rules[id] != Rule::None)
+	worklist.push_back(id);
+    };
+    const auto publish_all = [&] (const auto& Vs) {
+      for (llvm::Value *V : Vs)
+	publish(V);
+    };
+
+    for (llvm::Instruction& I : llvm::instructions(F)) {
+      Rule& rule = rules[ids[&I]];
+      if (auto *CB = llvm::dyn_cast<llvm::CallBase>(&I)) {
+	if (auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(CB)) {
+	  if (!II->getType()->isVoidTy() && !II->isAssumeLikeIntrinsic())
+	    rule = getIntrinsicRule(II);
+	}
+      } else if (llvm::isa<llvm::LoadInst, llvm::AtomicRMWInst, llvm::AtomicCmpXchgInst>(&I)) {
+	rule = Rule::Memory;
+      } else if (I.getType()->isVoidTy()) {
+	// nothing to propagate
+      } else if (llvm::isa<llvm::CmpInst, llvm::CastInst, llvm::BinaryOperator, llvm::SelectInst, llvm::PHINode, llvm::FreezeInst>(&I)) {
+	rule = Rule::Operands;
+      } else if (auto *UI = llvm::dyn_cast<llvm::UnaryOperator>(&I)) {
+	assert(UI->getOpcode() == llvm::UnaryOperator::UnaryOps::FNeg);
+	rule = Rule::Operands;
+      } else if (llvm::isa<llvm::GetElementPtrInst, llvm::AllocaInst, llvm::LandingPadInst>(&I)) {
+	// GEPs' operands are published unconditionally below
+      } else if (llvm::isa<llvm::InsertElementInst, llvm::ShuffleVectorInst, llvm::ExtractElementInst,
+		 llvm::ExtractValueInst, llvm::InsertValueInst>(&I)) {
+	// ignore: make more precise later
+      } else {
+	unhandled_instruction(I);
+      }
+    }
+
+    // Initialize public values with transmitter operands.
     for (llvm::Instruction& I : llvm::instructions(F))
       for (const TransmitterOperand& op : get_transmitter_sensitive_operands(&I))
 	if (auto *I = llvm::dyn_cast<llvm::Instruction>(op.V))
-	  pub_vals.insert(I);
+	  publish(I);
 
     // All pointer values are public.
     for (llvm::Instruction& I : llvm::instructions(F))
       if (I.getType()->isPointerTy())
-	pub_vals.insert(&I);
+	publish(&I);
 
-    // Add public non-instruction operands (arguments are handled later for simplicity)
+    // Add public non-instruction operands.
     for (llvm::Instruction& I : llvm::instructions(F))
       for (llvm::Value *op_V : I.operands())
 	if (llvm::isa<llvm::BasicBlock, llvm::InlineAsm, llvm::Constant, llvm::LandingPadInst>(op_V))
-	  pub_vals.insert(op_V);
-    
-    if (StrictCallingConv) 
-      for (auto& A : F.args())
-	pub_vals.insert(&A);
+	  publish(op_V);
 
-    VSet pub_vals_bak;
-    std::set<llvm::Instruction *> seen_mem_taint_prop;
-    do {
-      pub_vals_bak = pub_vals;
+    // GEP operands are always public.
+    for (llvm::GetElementPtrInst& GEP : util::instructions<llvm::GetElementPtrInst>(F))
+      publish_all(GEP.operands());
+    
+    if (StrictCallingConv) {
+      for (llvm::Argument& A : F.args())
+	publish(&A);
 
-      // Propagate calls.
+      // Regular calls conform to ClouCC CallingConv: all arguments and the return value are public.
       for (llvm::CallBase& CB : util::instructions<llvm::CallBase>(F)) {
-	if (auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(&CB)) {
-	  if (!II->getType()->isVoidTy() && !II->isAssumeLikeIntrinsic()) {
-	    const auto id = II->getIntrinsicID();
-	    enum class Taint {
-	      Passthrough,
-	      Invalid,
-	      Handled,
-	    } taint_rule = Taint::Invalid;
-	  
-	    switch (id) {
-	    case llvm::Intrinsic::memset:
-	    case llvm::Intrinsic::memcpy:
-	    case llvm::Intrinsic::x86_sse2_lfence:
-	      taint_rule = Taint::Invalid;
-	      break;
-
-	    case llvm::Intrinsic::vector_reduce_and:
-	    case llvm::Intrinsic::vector_reduce_add:	      
-	    case llvm::Intrinsic::vector_reduce_or:
-	    case llvm::Intrinsic::fshl:
-	    case llvm::Intrinsic::ctpop:
-	    case llvm::Intrinsic::x86_aesni_aeskeygenassist:
-	    case llvm::Intrinsic::x86_aesni_aesenc:
-	    case llvm::Intrinsic::x86_aesni_aesenclast:
-	    case llvm::Intrinsic::bswap:
-	    case llvm::Intrinsic::x86_pclmulqdq:
-	    case llvm::Intrinsic::umin:
-	    case llvm::Intrinsic::umax:
-	    case llvm::Intrinsic::smin:
-	    case llvm::Intrinsic::smax:
-	    case llvm::Intrinsic::abs:	      
-	    case llvm::Intrinsic::x86_rdrand_32:
-	    case llvm::Intrinsic::umul_with_overflow:
-	    case llvm::Intrinsic::bitreverse:
-	    case llvm::Intrinsic::cttz:
-	    case llvm::Intrinsic::usub_sat:
-	    case llvm::Intrinsic::fmuladd:
-	    case llvm::Intrinsic::fabs:
-	    case llvm::Intrinsic::experimental_constrained_fcmp:
-	    case llvm::Intrinsic::experimental_constrained_fsub:
-	    case llvm::Intrinsic::experimental_constrained_fmul:
-	    case llvm::Intrinsic::experimental_constrained_sitofp:
-	    case llvm::Intrinsic::experimental_constrained_uitofp:
-	    case llvm::Intrinsic::experimental_constrained_fcmps:
-	    case llvm::Intrinsic::experimental_constrained_fadd:	
-	    case llvm::Intrinsic::experimental_constrained_fptosi:
-	    case llvm::Intrinsic::experimental_constrained_fdiv:
-	    case llvm::Intrinsic::experimental_constrained_fptoui:
-	    case llvm::Intrinsic::experimental_constrained_fpext:
-	    case llvm::Intrinsic::experimental_constrained_floor:
-	    case llvm::Intrinsic::experimental_constrained_ceil:
-	    case llvm::Intrinsic::experimental_constrained_fptrunc:
-	    case llvm::Intrinsic::experimental_constrained_fmuladd:
-	    case llvm::Intrinsic::masked_load:
-	    case llvm::Intrinsic::masked_gather:
-	    case llvm::Intrinsic::stacksave:
-	    case llvm::Intrinsic::fshr:
-	    case llvm::Intrinsic::vector_reduce_mul:
-	    case llvm::Intrinsic::vector_reduce_umax:	    
-	    case llvm::Intrinsic::vector_reduce_umin:
-	    case llvm::Intrinsic::vector_reduce_smax:	    
-	    case llvm::Intrinsic::vector_reduce_smin:
-	    case llvm::Intrinsic::vector_reduce_xor:
-	    case llvm::Intrinsic::eh_typeid_for:
-	    case llvm::Intrinsic::uadd_with_overflow:
-	    case llvm::Intrinsic::ctlz:
-	    case llvm::Intrinsic::experimental_constrained_powi:	      
-	    case llvm::Intrinsic::experimental_constrained_trunc:
-	    case llvm::Intrinsic::experimental_constrained_round:
-	    case llvm::Intrinsic::uadd_sat:
-	      taint_rule = Taint::Passthrough;
-	      break;
-
-	    case llvm::Intrinsic::annotation:
-	      if (pub_vals.contains(II)) {
-		pub_vals.insert(II->getArgOperand(0));
-	      }
-	      taint_rule = Taint::Handled;
-	      break;
-
-	    default:
-	      warn_unhandled_intrinsic(II);
-	    }
-
-	    switch (taint_rule) {
-	    case Taint::Handled:
-	      break;
-	    case Taint::Invalid:
-	      assert(II->getType()->isVoidTy());
-	      break;
-	    case Taint::Passthrough:
-	      if (pub_vals.contains(II)) {
-		for (llvm::Value *V : II->args()) {
-		  pub_vals.insert(V);
-		}
-	      }
-	      break;
-	    }
-	  }
-	} else {
-	  // Regular call instruction -- assume it conforms to ClouCC CallingConv.
-	  if (StrictCallingConv) {
-	    // All arguments are public
-	    for (llvm::Value *V : CB.args())
-	      pub_vals.insert(V);
-	    // Return value is public
-	    pub_vals.insert(&CB);
-	  }
+	if (!llvm::isa<llvm::IntrinsicInst>(&CB)) {
+	  publish_all(CB.args());
+	  publish(&CB);
 	}
       }
 
-      // Propagate taint through all memory access instructions.
-      for (llvm::Instruction& src : llvm::instructions(F)) {
-	if (seen_mem_taint_prop.contains(&src))
-	  continue;
-	llvm::Value *src_ptr = util::getPointerOperand(&src);
-	const auto src_vals = util::getAccessOperands(&src);
-	const bool src_vals_tainted = llvm::isa<llvm::LoadInst, llvm::AtomicRMWInst, llvm::AtomicCmpXchgInst>(&src) &&
-	  pub_vals.contains(&src);
-	if (src_ptr && src_vals_tainted) {
-	  seen_mem_taint_prop.insert(&src);
-	  llvm::copy(src_vals, std::inserter(pub_vals, pub_vals.end())); // all source values are tainted
-	  for (llvm::Instruction& dst : llvm::instructions(F)) {
-	    if (llvm::Value *dst_ptr = util::getPointerOperand(&dst)) {
-	      if (isDefinitelyMustAlias(AA.alias(src_ptr, dst_ptr))) {
-		llvm::copy(util::getAccessOperands(&dst), std::inserter(pub_vals, pub_vals.end()));
-	      }
-	    }
-	  }
-	}
-      }
+      for (auto& RI : util::instructions<llvm::ReturnInst>(F))
+	publish(RI.getReturnValue());
+    }
 
-      if (StrictCallingConv) {
-	for (auto& RI : util::instructions<llvm::ReturnInst>(F))
-	  pub_vals.insert(RI.getReturnValue());
-      }
-      
-      for (llvm::Instruction& I : util::nonvoid_instructions(F)) {
-	if (auto *GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(&I)) {
-	  addAllOperands(GEP);
-	} else if (llvm::isa<llvm::CmpInst, llvm::CastInst, llvm::BinaryOperator, llvm::SelectInst, llvm::PHINode, llvm::FreezeInst>(&I)) {
-	  if (pub_vals.contains(&I)) {
-	    addAllOperands(&I);
-	  }
-	} else if (auto *UI = llvm::dyn_cast<llvm::UnaryOperator>(&I)) {
-	  assert(UI->getOpcode() == llvm::UnaryOperator::UnaryOps::FNeg);
-	  if (pub_vals.contains(&I)) {
-	    addAllOperands(&I);
-	  }
-	} else if (llvm::isa<llvm::CallBase, llvm::LoadInst, llvm::AllocaInst, llvm::AtomicRMWInst, llvm::AtomicCmpXchgInst,
-		   llvm::LandingPadInst>(&I)) {
-	  // ignore: already handled
-	} else if (llvm::isa<llvm::InsertElementInst, llvm::ShuffleVectorInst, llvm::ExtractElementInst,
-		   llvm::ExtractValueInst, llvm::InsertValueInst>(&I)) {
-	  // ignore: make more precise later
-	} else {
-	  unhandled_instruction(I);
-	}
+    /* Memory accesses that must alias, for propagating taint through memory. Only the accesses that an ObjectPartition
+     * leaves as candidates can alias at all; the must-aliasing ones are memoized per pointer.
+     */
+    ObjectPartition<llvm::Instruction *> accesses;
+    for (llvm::Instruction& I : llvm::instructions(F))
+      if (llvm::Value *ptr = util::getPointerOperand(&I))
+	accesses.insert(ptr, &I);
+    llvm::DenseMap<const llvm::Value *, std::vector<llvm::Instruction *>> must_aliases;
+    const auto get_must_aliases = [&] (llvm::Value *src_ptr) -> const std::vector<llvm::Instruction *>& {
+      const auto [it, inserted] = must_aliases.try_emplace(src_ptr);
+      if (inserted)
+	accesses.for_each_candidate(src_ptr, [&] (llvm::Instruction *dst) {
+	  if (isDefinitelyMustAlias(AA.alias(src_ptr, util::getPointerOperand(dst))))
+	    it->second.push_back(dst);
+	});
+      return it->second;
+    };
+
+    while (!worklist.empty()) {
+      llvm::Instruction *I = llvm::cast<llvm::Instruction>(values[worklist.back()]);
+      const Rule rule = rules[worklist.back()];
+      worklist.pop_back();
+      switch (rule) {
+      case Rule::None:
+	break;
+      case Rule::Operands:
+	publish_all(I->operands());
+	break;
+      case Rule::Args:
+	publish_all(llvm::cast<llvm::CallBase>(I)->args());
+	break;
+      case Rule::FirstArg:
+	publish(llvm::cast<llvm::CallBase>(I)->getArgOperand(0));
+	break;
+      case Rule::Memory:
+	// All source values are tainted, and so are the values of every access that must alias it.
+	publish_all(util::getAccessOperands(I));
+	for (llvm::Instruction *dst : get_must_aliases(util::getPointerOperand(I)))
+	  publish_all(util::getAccessOperands(dst));
+	break;
       }
-      
-    } while (pub_vals != pub_vals_bak);
+    }
 
     return false;
   }
 
-  void NonspeculativeTaint::addAllOperands(llvm::User *U) {
-    for (llvm::Value *op : U->operands()) {
-      pub_vals.insert(op);
-    }
-  }
-  
   void NonspeculativeTaint::print(llvm::raw_ostream& os, const llvm::Module *) const {
     os << "Nonspeculatively Public Values:\n";
-    for (const llvm::Value *V : pub_vals) {
+    for (unsigned id : pub_vals.set_bits()) {
+      const llvm::Value *V = values[id];
       if (!llvm::isa<llvm::BasicBlock, llvm::Function>(V)) {
 	os << *V << "\n";
       }
@@ -265,8 +300,10 @@ namespace clou {
   }
 
   bool NonspeculativeTaint::secret(llvm::Value *V) const {
-    if (auto *I = llvm::dyn_cast<llvm::Instruction>(V))
-      return !pub_vals.contains(I);
+    if (auto *I = llvm::dyn_cast<llvm::Instruction>(V)) {
+      const auto it = ids.find(I);
+      return it == ids.end() || !pub_vals.test(it->second);
+    }
     else
       return false;
   }
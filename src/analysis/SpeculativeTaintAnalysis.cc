@@ -11,14 +11,33 @@
 #include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/Clou/Clou.h>
 #include <llvm/ADT/SparseBitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/CommandLine.h>
 
 #include "clou/util.h"
 #include "clou/Mitigation.h"
+#include "clou/ObjectPartition.h"
 #include "clou/analysis/NonspeculativeTaintAnalysis.h"
 #include "clou/analysis/ConstantAddressAnalysis.h"
+#include "clou/analysis/DenseNumberingAnalysis.h"
 
 namespace clou {
 
+  enum class RFSMode {
+    Pairwise,
+    Objects,
+  };
+
+  static llvm::cl::opt<RFSMode> rfs_mode {
+    "clou-speculative-taint-rfs",
+    llvm::cl::desc("How SpeculativeTaint finds the constant-address loads that each store may be read by"),
+    llvm::cl::init(RFSMode::Objects),
+    llvm::cl::values(clEnumValN(RFSMode::Pairwise, "pairwise", "Query alias analysis for every store and load"),
+		     clEnumValN(RFSMode::Objects, "objects", "Skip the queries that BasicAA answers from distinct underlying objects")),
+  };
+
   char SpeculativeTaint::ID = 0;
   SpeculativeTaint::SpeculativeTaint(): llvm::FunctionPass(ID) {}
 
@@ -26,6 +45,7 @@ namespace clou {
     AU.addRequired<ConstantAddressAnalysis>();
     AU.addRequired<llvm::AAResultsWrapperPass>();
     AU.addRequired<NonspeculativeTaint>();
+    AU.addRequired<DenseNumbering>();
     AU.setPreservesAll();    
   }
 
@@ -59,146 +79,196 @@ namespace clou {
       assert(idx < ncals.size());
       return ncals[idx];
     };
-    
-    std::map<llvm::StoreInst *, std::set<llvm::LoadInst *>> rfs; // only to CALs though
-    for (llvm::StoreInst& SI : util::instructions<llvm::StoreInst>(F)) {
-      auto& loads = rfs[&SI];
+
+    /* Taints live in a vector indexed by the instructions' dense numbering rather than a map, and are solved with a
+     * def-use worklist: an instruction is only revisited when one of its operands' taints grew, and a store only pushes
+     * into the loads it may be read by when its value's taint grew.
+     */
+    const DenseNumbering& N = getAnalysis<DenseNumbering>();
+    const Idx num_insts = N.numInstructions();
+    const auto id = [&N] (const llvm::Instruction *I) -> Idx {
+      return N.id(I);
+    };
+
+    /* The may-read-from relation, flow-insensitively, since a speculative load can read from any store to its location
+     * that hasn't retired. Querying every store against every load is quadratic in alias queries, which large unrolled
+     * functions can't afford. In objects mode, stores are only queried against the loads an ObjectPartition leaves
+     * as candidates, which gives the same result as pairwise.
+     */
+    std::vector<std::vector<Idx>> rfs(num_insts); // only to CALs though
+    {
+      ObjectPartition<llvm::LoadInst *> cals;
       for (llvm::LoadInst& LI : util::instructions<llvm::LoadInst>(F))
-	if (CAA.isConstantAddress(LI.getPointerOperand()) &&
-	    !isDefinitelyNoAlias(AA.alias(SI.getPointerOperand(), LI.getPointerOperand())))
-	  loads.insert(&LI);
+	if (CAA.isConstantAddress(LI.getPointerOperand()))
+	  cals.insert(LI.getPointerOperand(), &LI);
+
+      for (llvm::StoreInst& SI : util::instructions<llvm::StoreInst>(F)) {
+	auto& loads = rfs[id(&SI)];
+	const auto query = [&] (llvm::LoadInst *LI) {
+	  if (!isDefinitelyNoAlias(AA.alias(SI.getPointerOperand(), LI->getPointerOperand())))
+	    loads.push_back(id(LI));
+	};
+	if (rfs_mode == RFSMode::Objects)
+	  cals.for_each_candidate(SI.getPointerOperand(), query);
+	else
+	  llvm::for_each(cals.getAll(), query);
+      }
     }
 
-    std::map<llvm::Instruction *, llvm::SparseBitVector<>> taints, taints_bak;
-
-    do {
-      taints_bak = taints;
-      
-      for (llvm::Instruction& I : llvm::instructions(F)) {
-	
-	if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(&I)) {
-	  if (!CAA.isConstantAddress(LI->getPointerOperand())) 
-	    taints[LI].set(ncal_to_idx(LI));
-	  continue;
-	}
+    std::vector<llvm::SparseBitVector<>> taints(num_insts);
+    const auto taint = [&] (const llvm::Instruction *I) -> llvm::SparseBitVector<>& {
+      return taints[id(I)];
+    };
 
-	if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(&I)) {
-	  if (auto *value_I = llvm::dyn_cast<llvm::Instruction>(SI->getValueOperand())) {
-	    const auto& orgs = taints[value_I];
-	    if (orgs != taints_bak[value_I])  // TODO: This is sound, right?
-	      for (llvm::LoadInst *LI : rfs[SI])
-		taints[LI] |= orgs;
+    std::vector<Idx> worklist;
+    llvm::BitVector queued(num_insts, true);
+    worklist.reserve(num_insts);
+    for (Idx i = num_insts; i > 0; --i)
+      worklist.push_back(i - 1); // popped in program order
+    const auto push_users = [&] (const llvm::Instruction *I) {
+      for (const llvm::User *U : I->users()) {
+	if (const auto *user_I = llvm::dyn_cast<llvm::Instruction>(U)) {
+	  const Idx i = id(user_I);
+	  if (!queued.test(i)) {
+	    queued.set(i);
+	    worklist.push_back(i);
 	  }
-	  continue;
 	}
+      }
+    };
 
-	if (llvm::IntrinsicInst *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I)) {
-	  if (!II->getType()->isVoidTy() && !II->isAssumeLikeIntrinsic()) {
-	    switch (II->getIntrinsicID()) {
-	    case llvm::Intrinsic::vector_reduce_add:
-	    case llvm::Intrinsic::vector_reduce_and:
-	    case llvm::Intrinsic::vector_reduce_or:
-	    case llvm::Intrinsic::fshl:
-	    case llvm::Intrinsic::umax:
-	    case llvm::Intrinsic::umin:
-	    case llvm::Intrinsic::ctpop:
-	    case llvm::Intrinsic::x86_aesni_aeskeygenassist:
-	    case llvm::Intrinsic::x86_aesni_aesenc:
-	    case llvm::Intrinsic::x86_aesni_aesenclast:
-	    case llvm::Intrinsic::bswap:
-	    case llvm::Intrinsic::x86_pclmulqdq:
-	    case llvm::Intrinsic::x86_rdrand_32:
-	    case llvm::Intrinsic::smax:
-	    case llvm::Intrinsic::smin:
-	    case llvm::Intrinsic::abs:
-	    case llvm::Intrinsic::umul_with_overflow:
-	    case llvm::Intrinsic::bitreverse:
-	    case llvm::Intrinsic::cttz:
-	    case llvm::Intrinsic::usub_sat:
-	    case llvm::Intrinsic::fmuladd:
-	    case llvm::Intrinsic::fabs:
-	    case llvm::Intrinsic::floor:
-	    case llvm::Intrinsic::experimental_constrained_fcmp:
-	    case llvm::Intrinsic::experimental_constrained_fsub:
-	    case llvm::Intrinsic::experimental_constrained_fmul:
-	    case llvm::Intrinsic::experimental_constrained_sitofp:
-	    case llvm::Intrinsic::experimental_constrained_uitofp:
-	    case llvm::Intrinsic::experimental_constrained_fcmps:
-	    case llvm::Intrinsic::experimental_constrained_fadd:	
-	    case llvm::Intrinsic::experimental_constrained_fptosi:
-	    case llvm::Intrinsic::experimental_constrained_fdiv:
-	    case llvm::Intrinsic::experimental_constrained_fptoui:
-	    case llvm::Intrinsic::experimental_constrained_fpext:
-	    case llvm::Intrinsic::experimental_constrained_floor:
-	    case llvm::Intrinsic::experimental_constrained_fptrunc:
-	    case llvm::Intrinsic::experimental_constrained_fmuladd:
-	    case llvm::Intrinsic::experimental_constrained_ceil:
-	    case llvm::Intrinsic::masked_load:
-	    case llvm::Intrinsic::masked_gather:
-	    case llvm::Intrinsic::fshr:
-	    case llvm::Intrinsic::stacksave:
-	    case llvm::Intrinsic::vector_reduce_mul:
-	    case llvm::Intrinsic::vector_reduce_umax:	    	      
-	    case llvm::Intrinsic::vector_reduce_umin:
-	    case llvm::Intrinsic::vector_reduce_smax:	    	      
-	    case llvm::Intrinsic::vector_reduce_xor:
-	    case llvm::Intrinsic::vector_reduce_smin:
-	    case llvm::Intrinsic::eh_typeid_for:
-	    case llvm::Intrinsic::uadd_with_overflow:
-	    case llvm::Intrinsic::ctlz:
-	    case llvm::Intrinsic::experimental_constrained_powi:
-	    case llvm::Intrinsic::experimental_constrained_trunc:	      
-	    case llvm::Intrinsic::experimental_constrained_round:
-	    case llvm::Intrinsic::uadd_sat:	      
-	      // Passthrough
-	      for (llvm::Value *arg_V : II->args())
-		if (llvm::Instruction *arg_I = llvm::dyn_cast<llvm::Instruction>(arg_V))
-		  taints[II] |= taints[arg_I];
-	      break;
-
-	    case llvm::Intrinsic::annotation:
-	      if (auto *arg = llvm::dyn_cast<llvm::Instruction>(II->getArgOperand(0)))
-		taints[II] |= taints[arg];
-	      break;
-	      
-	    default:
-	      warn_unhandled_intrinsic(II);
-	    }
-	  }
+    // Applies I's transfer function, returning whether I's own taint grew.
+    const auto transfer = [&] (llvm::Instruction& I) -> bool {
+      bool changed = false;
 
-	  continue;
-	}
+      if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+	if (!CAA.isConstantAddress(LI->getPointerOperand())) 
+	  changed |= taint(LI).test_and_set(ncal_to_idx(LI));
+	return changed;
+      }
 
-	if (llvm::isa<llvm::CallBase>(&I)) {
-	  // Calls never return speculatively tainted values by assumption. We must uphold this.
-	  continue;
+      if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+	if (auto *value_I = llvm::dyn_cast<llvm::Instruction>(SI->getValueOperand())) {
+	  const auto& orgs = taint(value_I);
+	  if (!orgs.empty()) {
+	    for (Idx load : rfs[id(SI)])
+	      if (taints[load] |= orgs)
+		push_users(N.instruction(load));
+	  }
 	}
+	return false;
+      }
 
-	if (llvm::isa<MitigationInst>(&I)) {
-	  continue;
-	}
+      if (llvm::IntrinsicInst *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I)) {
+	if (!II->getType()->isVoidTy() && !II->isAssumeLikeIntrinsic()) {
+	  switch (II->getIntrinsicID()) {
+	  case llvm::Intrinsic::vector_reduce_add:
+	  case llvm::Intrinsic::vector_reduce_and:
+	  case llvm::Intrinsic::vector_reduce_or:
+	  case llvm::Intrinsic::fshl:
+	  case llvm::Intrinsic::umax:
+	  case llvm::Intrinsic::umin:
+	  case llvm::Intrinsic::ctpop:
+	  case llvm::Intrinsic::x86_aesni_aeskeygenassist:
+	  case llvm::Intrinsic::x86_aesni_aesenc:
+	  case llvm::Intrinsic::x86_aesni_aesenclast:
+	  case llvm::Intrinsic::bswap:
+	  case llvm::Intrinsic::x86_pclmulqdq:
+	  case llvm::Intrinsic::x86_rdrand_32:
+	  case llvm::Intrinsic::smax:
+	  case llvm::Intrinsic::smin:
+	  case llvm::Intrinsic::abs:
+	  case llvm::Intrinsic::umul_with_overflow:
+	  case llvm::Intrinsic::bitreverse:
+	  case llvm::Intrinsic::cttz:
+	  case llvm::Intrinsic::usub_sat:
+	  case llvm::Intrinsic::fmuladd:
+	  case llvm::Intrinsic::fabs:
+	  case llvm::Intrinsic::floor:
+	  case llvm::Intrinsic::experimental_constrained_fcmp:
+	  case llvm::Intrinsic::experimental_constrained_fsub:
+	  case llvm::Intrinsic::experimental_constrained_fmul:
+	  case llvm::Intrinsic::experimental_constrained_sitofp:
+	  case llvm::Intrinsic::experimental_constrained_uitofp:
+	  case llvm::Intrinsic::experimental_constrained_fcmps:
+	  case llvm::Intrinsic::experimental_constrained_fadd:	
+	  case llvm::Intrinsic::experimental_constrained_fptosi:
+	  case llvm::Intrinsic::experimental_constrained_fdiv:
+	  case llvm::Intrinsic::experimental_constrained_fptoui:
+	  case llvm::Intrinsic::experimental_constrained_fpext:
+	  case llvm::Intrinsic::experimental_constrained_floor:
+	  case llvm::Intrinsic::experimental_constrained_fptrunc:
+	  case llvm::Intrinsic::experimental_constrained_fmuladd:
+	  case llvm::Intrinsic::experimental_constrained_ceil:
+	  case llvm::Intrinsic::masked_load:
+	  case llvm::Intrinsic::masked_gather:
+	  case llvm::Intrinsic::fshr:
+	  case llvm::Intrinsic::stacksave:
+	  case llvm::Intrinsic::vector_reduce_mul:
+	  case llvm::Intrinsic::vector_reduce_umax:	    	      
+	  case llvm::Intrinsic::vector_reduce_umin:
+	  case llvm::Intrinsic::vector_reduce_smax:	    	      
+	  case llvm::Intrinsic::vector_reduce_xor:
+	  case llvm::Intrinsic::vector_reduce_smin:
+	  case llvm::Intrinsic::eh_typeid_for:
+	  case llvm::Intrinsic::uadd_with_overflow:
+	  case llvm::Intrinsic::ctlz:
+	  case llvm::Intrinsic::experimental_constrained_powi:
+	  case llvm::Intrinsic::experimental_constrained_trunc:	      
+	  case llvm::Intrinsic::experimental_constrained_round:
+	  case llvm::Intrinsic::uadd_sat:	      
+	    // Passthrough
+	    for (llvm::Value *arg_V : II->args())
+	      if (llvm::Instruction *arg_I = llvm::dyn_cast<llvm::Instruction>(arg_V))
+		changed |= taint(II) |= taint(arg_I);
+	    break;
 
-	if (!I.getType()->isVoidTy()) {
-	  // taint if any inputs are tainted
-	  auto& out = taints[&I];
-	  for (llvm::Value *op_V : I.operands()) {
-	    if (auto *op_I = llvm::dyn_cast<llvm::Instruction>(op_V)) {
-	      const auto& in = taints[op_I];
-	      out |= in;
-	    }
+	  case llvm::Intrinsic::annotation:
+	    if (auto *arg = llvm::dyn_cast<llvm::Instruction>(II->getArgOperand(0)))
+	      changed |= taint(II) |= taint(arg);
+	    break;
+
+	  default:
+	    warn_unhandled_intrinsic(II);
 	  }
-	  continue;
 	}
-	  
+
+	return changed;
+      }
+
+      if (llvm::isa<llvm::CallBase>(&I)) {
+	// Calls never return speculatively tainted values by assumption. We must uphold this.
+	return false;
+      }
+
+      if (llvm::isa<MitigationInst>(&I)) {
+	return false;
+      }
+
+      if (!I.getType()->isVoidTy()) {
+	// taint if any inputs are tainted
+	auto& out = taint(&I);
+	for (llvm::Value *op_V : I.operands())
+	  if (auto *op_I = llvm::dyn_cast<llvm::Instruction>(op_V))
+	    changed |= out |= taint(op_I);
       }
 
-    } while (taints != taints_bak);
+      return changed;
+    };
+
+    while (!worklist.empty()) {
+      const Idx i = worklist.back();
+      worklist.pop_back();
+      queued.reset(i);
+      if (transfer(*N.instruction(i)))
+	push_users(N.instruction(i));
+    }
 
     // Convert back to easy-to-process results.
     this->taints.clear();
-    for (const auto& [I, iorgs] : taints) {
-      auto& orgs = this->taints[I];
-      for (Idx idx : iorgs)
+    for (Idx i = 0; i < num_insts; ++i) {
+      auto& orgs = this->taints[N.instruction(i)];
+      for (Idx idx : taints[i])
 	orgs.insert(idx_to_ncal(idx));
     }
 
@@ -226,5 +296,5 @@ namespace clou {
 
   static llvm::RegisterPass<SpeculativeTaint> X {"clou-speculative-taint", "Clou's Speculative Taint Analysis Pass", true, true};
   // util::RegisterClangPass<SpeculativeTaint> Y;
-  
+
 }
@@ -17,6 +17,7 @@
 #include "clou/analysis/LeakAnalysis.h"
 #include "clou/analysis/SpeculativeTaintAnalysis.h"
 #include "clou/Frontier.h"
+#include "clou/analysis/DenseNumberingAnalysis.h"
 
 namespace clou {
 
@@ -28,6 +29,7 @@ namespace clou {
     AU.addRequired<llvm::AAResultsWrapperPass>();
     AU.addRequired<LeakAnalysis>();
     AU.addRequired<SpeculativeTaint>();
+    AU.addRequired<DenseNumbering>();
     AU.setPreservesAll();
   }
 
@@ -38,6 +40,7 @@ namespace clou {
     auto& AA = getAnalysis<llvm::AAResultsWrapperPass>().getAAResults();
     auto& LA = getAnalysis<LeakAnalysis>();
     auto& ST = getAnalysis<SpeculativeTaint>();
+    const auto& N = getAnalysis<DenseNumbering>();
 
     llvm::DataLayout DL(F.getParent());
 
@@ -59,7 +62,7 @@ namespace clou {
 	  }
 	}
 	return false;
-      }, must_alias_frontier);
+      }, must_alias_frontier, N);
 
       if (ok) {
 	for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
@@ -76,7 +79,7 @@ namespace clou {
 	  const auto mri = AA.getModRefInfo(I, LI.getPointerOperand(),
 					    llvm::LocationSize::precise(DL.getTypeStoreSize(LI.getType())));
 	  return llvm::isModSet(mri);
-	}, may_alias_frontier);
+	}, may_alias_frontier, N);
 	assert(!may_alias_frontier.empty());
 	if (ok && may_alias_frontier.size() == 1) {
 	  for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
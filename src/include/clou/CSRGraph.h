@@ -0,0 +1,225 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <optional>
+#include <iterator>
+#include <cassert>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Sequence.h>
+#include <llvm/ADT/iterator_range.h>
+
+#include "clou/Capacity.h"
+
+namespace clou {
+
+  /* Compressed-sparse-row graph for the min-cut algorithms.
+   * Row u holds u's forward arcs (sorted by target) followed by the reverse twins of the arcs entering u, so that the
+   * same arrays give successors, predecessors and residual arcs. rev(a) is the index of a's twin.
+   * Cutting an edge only masks its forward arc; the arrays themselves never change after construction.
+   */
+  class CSRGraph {
+  public:
+    using Node = unsigned;
+    using Weight = Capacity;
+    using Arc = unsigned;
+
+    struct Edge {
+      Node src;
+      Node dst;
+      Weight w;
+    };
+
+    CSRGraph() = default;
+
+    // Duplicate (src, dst) pairs are not allowed.
+    CSRGraph(unsigned n, llvm::ArrayRef<Edge> edges): offsets(n + 1, 0), splits(n, 0) {
+      for (const Edge& e : edges) {
+	assert(e.src < n && e.dst < n);
+	++offsets[e.src + 1];
+	++offsets[e.dst + 1];
+	++splits[e.src];
+      }
+      for (Node u = 0; u < n; ++u)
+	offsets[u + 1] += offsets[u];
+      for (Node u = 0; u < n; ++u)
+	splits[u] += offsets[u];
+
+      const unsigned m = offsets.back();
+      targets.resize(m);
+      capacities.resize(m, 0);
+      revs.resize(m);
+      forward.resize(m, false);
+      removed.resize(m, false);
+
+      // Lay out forward arcs first, then sort each row's forward arcs by target, and only then attach the twins, so
+      // that rev() stays valid.
+      std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+      for (const Edge& e : edges) {
+	const Arc a = fill[e.src]++;
+	targets[a] = e.dst;
+	capacities[a] = e.w;
+	forward.set(a);
+      }
+      for (Node u = 0; u < n; ++u) {
+	std::vector<std::pair<Node, Weight>> row;
+	for (Arc a : fwd_arcs(u))
+	  row.emplace_back(targets[a], capacities[a]);
+	llvm::sort(row);
+	assert(std::adjacent_find(row.begin(), row.end(), [] (const auto& a, const auto& b) {
+	  return a.first == b.first;
+	}) == row.end() && "duplicate edge");
+	for (Arc a = offsets[u]; const auto& [v, w] : row) {
+	  targets[a] = v;
+	  capacities[a] = w;
+	  ++a;
+	}
+      }
+      for (Node u = 0; u < n; ++u) {
+	for (Arc a : fwd_arcs(u)) {
+	  const Node v = targets[a];
+	  const Arc b = fill[v]++;
+	  targets[b] = u;
+	  revs[a] = b;
+	  revs[b] = a;
+	}
+      }
+    }
+
+    template <class W>
+    CSRGraph(const std::vector<std::map<Node, W>>& G): CSRGraph(G.size(), flatten(G)) {}
+
+    unsigned nodes() const { return splits.size(); }
+    unsigned arcs() const { return targets.size(); }
+
+    using ArcRange = llvm::iota_range<Arc>;
+    ArcRange fwd_arcs(Node u) const { return llvm::seq(offsets[u], splits[u]); }
+    ArcRange rev_arcs(Node u) const { return llvm::seq(splits[u], offsets[u + 1]); }
+    ArcRange all_arcs(Node u) const { return llvm::seq(offsets[u], offsets[u + 1]); }
+
+    Node target(Arc a) const { return targets[a]; }
+    Arc rev(Arc a) const { return revs[a]; }
+    bool is_fwd(Arc a) const { return forward.test(a); }
+
+    // The forward arc an arc belongs to.
+    Arc edge(Arc a) const { return is_fwd(a) ? a : revs[a]; }
+
+    // Original weight of a forward arc, regardless of whether it is cut.
+    Weight weight(Arc a) const {
+      assert(is_fwd(a));
+      return capacities[a];
+    }
+
+    // Effective capacity: 0 for reverse twins and for cut edges.
+    Weight capacity(Arc a) const {
+      return removed.test(a) ? 0 : capacities[a];
+    }
+
+    // Mask of cut edges, indexed by forward arc.
+    const llvm::BitVector& removed_edges() const { return removed; }
+
+    void set_removed_edges(const llvm::BitVector& mask) {
+      assert(mask.size() == removed.size());
+      removed = mask;
+    }
+
+    bool is_removed(Arc a) const { return removed.test(edge(a)); }
+    bool is_live(Arc a) const { return !removed.test(edge(a)); }
+
+    std::optional<Arc> find(Node u, Node v) const {
+      const auto begin = targets.begin() + offsets[u];
+      const auto end = targets.begin() + splits[u];
+      const auto it = std::lower_bound(begin, end, v);
+      if (it == end || *it != v)
+	return std::nullopt;
+      return it - targets.begin();
+    }
+
+    Arc at(Node u, Node v) const {
+      const auto a = find(u, v);
+      assert(a && "no such edge");
+      return *a;
+    }
+
+    bool contains(Node u, Node v) const {
+      const auto a = find(u, v);
+      return a && !removed.test(*a);
+    }
+
+    // Returns whether the edge was live.
+    bool remove(Node u, Node v) {
+      const Arc a = at(u, v);
+      const bool live = !removed.test(a);
+      removed.set(a);
+      return live;
+    }
+
+    // Returns whether the edge was cut.
+    bool restore(Node u, Node v) {
+      const Arc a = at(u, v);
+      const bool cut = removed.test(a);
+      removed.reset(a);
+      return cut;
+    }
+
+    // Iterates over the other endpoint of a run of arcs, skipping cut edges.
+    class node_iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = Node;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const Node *;
+      using reference = Node;
+
+      node_iterator(const CSRGraph *G, Arc a, Arc end): G(G), a(a), end(end) { skip(); }
+      Node operator*() const { return G->targets[a]; }
+      node_iterator& operator++() { ++a; skip(); return *this; }
+      node_iterator operator++(int) { node_iterator tmp = *this; ++*this; return tmp; }
+      bool operator==(const node_iterator& o) const { return a == o.a; }
+      bool operator!=(const node_iterator& o) const { return a != o.a; }
+
+    private:
+      const CSRGraph *G;
+      Arc a;
+      Arc end;
+
+      void skip() {
+	while (a != end && G->is_removed(a))
+	  ++a;
+      }
+    };
+    using node_range = llvm::iterator_range<node_iterator>;
+
+    // Live successors / predecessors.
+    node_range succs(Node u) const {
+      return node_range(node_iterator(this, offsets[u], splits[u]), node_iterator(this, splits[u], splits[u]));
+    }
+
+    node_range preds(Node v) const {
+      return node_range(node_iterator(this, splits[v], offsets[v + 1]),
+			node_iterator(this, offsets[v + 1], offsets[v + 1]));
+    }
+
+  private:
+    std::vector<unsigned> offsets;
+    std::vector<unsigned> splits; // end of the forward arcs of each row
+    std::vector<Node> targets;
+    std::vector<Weight> capacities; // 0 for reverse twins
+    std::vector<Arc> revs;
+    llvm::BitVector forward;
+    llvm::BitVector removed;
+
+    template <class W>
+    static std::vector<Edge> flatten(const std::vector<std::map<Node, W>>& G) {
+      std::vector<Edge> edges;
+      for (Node u = 0; u < G.size(); ++u)
+	for (const auto& [v, w] : G[u])
+	  edges.push_back({.src = u, .dst = v, .w = w});
+      return edges;
+    }
+  };
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+namespace clou {
+
+  template <class T>
+  T saturating_add(T a, T b) {
+    static_assert(std::is_unsigned_v<T>);
+    return a > std::numeric_limits<T>::max() - b ? std::numeric_limits<T>::max() : a + b;
+  }
+
+  template <class T>
+  T saturating_mul(T a, T b) {
+    static_assert(std::is_unsigned_v<T>);
+    return b != 0 && a > std::numeric_limits<T>::max() / b ? std::numeric_limits<T>::max() : a * b;
+  }
+
+  /* Edge capacities in the min-cut graphs are 64-bit fixed-point costs, with capacity_scale units per unit of cost.
+   * A single edge never exceeds max_capacity, which leaves 16 bits of headroom: flows, excesses (int64_t) and sums of
+   * capacities around a node or along a cut can't overflow until tens of thousands of saturated edges add up, and even
+   * then the sums saturate rather than wrap.
+   */
+  using Capacity = uint64_t;
+  inline constexpr Capacity capacity_scale = 1000;
+  inline constexpr Capacity max_capacity = Capacity(1) << 48;
+
+  // Sum of two edges' capacities, e.g. when merging parallel edges.
+  inline Capacity merge_capacities(Capacity a, Capacity b) {
+    return std::min(saturating_add(a, b), max_capacity);
+  }
+
+  // Rounds a cost to fixed point, clamped to [1, max_capacity], so that no edge is free to cut. NaN clamps to 1.
+  inline Capacity to_capacity(double cost) {
+    const double scaled = std::round(cost * capacity_scale);
+    if (!(scaled >= 1.))
+      return 1;
+    if (scaled >= static_cast<double>(max_capacity))
+      return max_capacity;
+    return static_cast<Capacity>(scaled);
+  }
+
+}
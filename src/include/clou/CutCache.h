@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <utility>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace clou {
+
+  extern std::string cut_cache_dir; // set by -clou-cut-cache-dir; empty disables the cache
+
+  using CutCacheEdge = std::pair<llvm::Instruction *, llvm::Instruction *>;
+
+  /* Key for F's cut: a hash of F's IR, canonicalized so that it doesn't depend on the rest of the module (debug
+   * locations are dropped and metadata/attribute group numbers are renumbered in order of appearance), together with
+   * the declarations F refers to, the build of the passes (CLOU_BUILD_ID) and the given description of the options
+   * that affect the cut.
+   */
+  std::string getCutCacheKey(const llvm::Function& F, llvm::StringRef options);
+
+  // Returns the cached cut of F, if there is one for key.
+  std::optional<std::vector<CutCacheEdge>> loadCutCache(llvm::Function& F, llvm::StringRef key);
+
+  void saveCutCache(const llvm::Function& F, llvm::StringRef key, llvm::ArrayRef<CutCacheEdge> cut);
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <utility>
+#include <optional>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <limits>
+#include <charconv>
+
+namespace clou {
+
+  /* Dynamic execution counts of fences, for feeding a profiled run back into fence placement. A fence site is the
+   * function it is in plus the source edge it sits on, "<src debug loc>---><dst debug loc>", which is the description
+   * MitigatePass gives each mitigation. Programs built with TracePass and linked against the trace runtime write one
+   * at exit if CLOU_FENCE_PROFILE=<file> is set; MitigatePass reads it with -clou-fence-profile=<file>. The format is
+   * line-based, with tab-separated fields, since debug locations of inlined code contain spaces:
+   *
+   *   clou-fence-profile 1
+   *   <count>\t<function>\t<description>    (one line per site)
+   *
+   * Writing to an existing profile merges into it, summing counts, so several runs can go into one profile.
+   */
+  struct FenceProfile {
+    using Site = std::pair<std::string, std::string>; // function, description
+    std::map<Site, uint64_t> counts;
+
+    static constexpr const char *header = "clou-fence-profile 1";
+
+    // The string TracePass passes to clou_trace() for a site, and that the runtime splits back up with parse_key().
+    static std::string key(std::string_view function, std::string_view description) {
+      std::string s(function);
+      s += '\t';
+      s += description;
+      return s;
+    }
+
+    static std::optional<Site> parse_key(std::string_view key) {
+      const size_t tab = key.find('\t');
+      if (tab == std::string_view::npos)
+	return std::nullopt;
+      return Site(key.substr(0, tab), key.substr(tab + 1));
+    }
+
+    /* Whether a description has a debug location on both sides of the edge. Without debug info, every edge in a
+     * function describes as "--->", so such sites lump together unrelated fences and are left out of profiles.
+     */
+    static bool has_locations(std::string_view description) {
+      const size_t arrow = description.find("--->");
+      return arrow != std::string_view::npos && arrow != 0 && arrow + 4 != description.size();
+    }
+
+    void add(const Site& site, uint64_t n) {
+      uint64_t& count = counts[site];
+      count = n > std::numeric_limits<uint64_t>::max() - count ? std::numeric_limits<uint64_t>::max() : count + n;
+    }
+
+    void write(std::ostream& os) const {
+      os << header << "\n";
+      for (const auto& [site, n] : counts)
+	os << n << "\t" << site.first << "\t" << site.second << "\n";
+    }
+
+    // Merges into this profile. Returns false if the input is malformed.
+    bool read(std::istream& is) {
+      std::string line;
+      if (!std::getline(is, line) || line != header)
+	return false;
+      while (std::getline(is, line)) {
+	if (line.empty())
+	  continue;
+	const size_t tab = line.find('\t');
+	if (tab == std::string::npos)
+	  return false;
+	uint64_t n;
+	const auto [end, ec] = std::from_chars(line.data(), line.data() + tab, n);
+	if (ec != std::errc() || end != line.data() + tab)
+	  return false;
+	const auto site = parse_key(std::string_view(line).substr(tab + 1));
+	if (!site)
+	  return false;
+	add(*site, n);
+      }
+      return true;
+    }
+  };
+
+}
@@ -8,16 +8,70 @@
 #include <cassert>
 #include <vector>
 #include <set>
+#include <memory>
 
 #include <llvm/ADT/ArrayRef.h>
 
+#include "clou/CSRGraph.h"
+
 namespace clou {
 
+  /* Max-flow engine used to compute each multi-s-t min cut.
+   * FordFulkerson: one augmenting path per search.
+   * Dinic: blocking flows over BFS level graphs.
+   * Both return the same (source-side minimal) cut.
+   */
+  enum class MaxFlowAlgorithm {
+    FordFulkerson,
+    Dinic,
+  };
+
+  extern MaxFlowAlgorithm max_flow_algorithm; // set by -clou-max-flow
+
   std::vector<std::pair<int, int>> ford_fulkerson(unsigned n,
 						  std::vector<std::map<unsigned, unsigned>>& G,
 						  unsigned s, unsigned t);
 
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const CSRGraph& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets);
+
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const CSRGraph& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets, MaxFlowAlgorithm algorithm);
+
   std::vector<std::pair<unsigned, unsigned>>
   ford_fulkerson_multi(const std::vector<std::map<unsigned, unsigned>>& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets);
-  
+
+  std::vector<std::pair<unsigned, unsigned>>
+  ford_fulkerson_multi(const std::vector<std::map<unsigned, unsigned>>& G, llvm::ArrayRef<std::set<unsigned>> waypoint_sets,
+		       MaxFlowAlgorithm algorithm);
+
+  class LeveledNetwork;
+
+  /* Min cut for one multi-waypoint ST that is re-solved as edges of the underlying CSRGraph are cut and restored.
+   * The residual network and its flow are kept between calls to solve(), which only cancels the flow on newly cut edges
+   * and then augments from there, rather than starting again from zero flow.
+   */
+  class IncrementalMinCut {
+  public:
+    IncrementalMinCut(llvm::ArrayRef<std::set<unsigned>> waypoint_sets, MaxFlowAlgorithm algorithm = max_flow_algorithm);
+    IncrementalMinCut(IncrementalMinCut&&);
+    IncrementalMinCut& operator=(IncrementalMinCut&&);
+    ~IncrementalMinCut();
+
+    // G must be the same graph (modulo cut edges) on every call.
+    const std::vector<std::pair<unsigned, unsigned>>& solve(const CSRGraph& G);
+
+    // Number of arcs in the retained residual network.
+    unsigned size() const;
+
+    // Drops the retained network; the next solve() starts from zero flow.
+    void release();
+
+  private:
+    std::vector<std::set<unsigned>> waypoint_sets;
+    MaxFlowAlgorithm algorithm;
+    std::unique_ptr<LeveledNetwork> network;
+    std::vector<std::pair<unsigned, unsigned>> cut;
+  };
+
 }
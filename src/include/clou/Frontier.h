@@ -10,6 +10,7 @@
 #include <llvm/IR/InstIterator.h>
 
 #include "clou/containers.h"
+#include "clou/analysis/DenseNumberingAnalysis.h"
 
 namespace clou {
 
@@ -19,8 +20,10 @@ namespace clou {
     return std::copy_if(PointerIt(llvm::inst_begin(F)), PointerIt(llvm::inst_end(F)), out, pred);
   }
 
-  ISet reachable_predecessors(llvm::Instruction *root);
-  bool forward_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier);
-  bool reverse_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier);
+  NumberedISet reachable_predecessors(llvm::Instruction *root, const DenseNumbering& N);
+  bool forward_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier,
+			const DenseNumbering& N);
+  bool reverse_frontier(llvm::Instruction *endpoint, std::function<bool (llvm::Instruction *)> pred, ISet& frontier,
+			const DenseNumbering& N);
 
 }
@@ -6,14 +6,25 @@
 #include <queue>
 #include <iostream>
 #include <cassert>
+#include <atomic>
 
 #include <llvm/ADT/iterator_range.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/WithColor.h>
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+
+#include "clou/MinCutInstance.h"
 
 namespace clou {
 
+extern unsigned min_cut_warm_start_limit; // set by -clou-min-cut-warm-start-limit
+extern unsigned min_cut_threads; // set by -clou-min-cut-threads
+extern unsigned min_cut_batch; // set by -clou-min-cut-batch
+extern bool condense_min_cut_graph; // set by -clou-min-cut-condense
+extern bool subsume_min_cut_sts; // set by -clou-min-cut-subsume
+extern unsigned reach_index_limit; // set by -clou-reach-index-limit
+
 template <class Node, class Weight>
 class MinCutBase {
 public:
@@ -79,8 +90,81 @@ public:
     assert(st.waypoints.size() >= 2);
   }
 
+  // Adds an ST with any number of waypoint sets.
+  void add_st_list(std::vector<std::set<Node>> waypoints) {
+    assert(waypoints.size() >= 2);
+    sts.push_back({.waypoints = std::move(waypoints)});
+  }
+
   virtual void run() = 0;
 
+  /* Cooperative cancellation, for running several solvers on the same problem at once. Once *cancel is set, run()
+   * returns as soon as it can, and its cut is unusable. interrupt() is called from another thread after setting *cancel,
+   * to wake up a run() that is blocked somewhere that doesn't poll it.
+   */
+  const std::atomic<bool> *cancel = nullptr;
+  bool cancelled() const {
+    return cancel && cancel->load(std::memory_order_relaxed);
+  }
+  virtual void interrupt() {}
+
+  // Whether G without the cut edges has no path through st's waypoint sets in order.
+  bool separates(const ST& st, const std::set<Edge>& cut) const {
+    std::set<Node> S = st.waypoints.front();
+    for (const auto& T : llvm::ArrayRef(st.waypoints).drop_front()) {
+      std::set<Node> reach;
+      std::vector<Node> todo(S.begin(), S.end());
+      while (!todo.empty()) {
+	const Node u = todo.back();
+	todo.pop_back();
+	const auto it = G.find(u);
+	if (it == G.end())
+	  continue;
+	for (const auto& [v, w] : it->second)
+	  if (!cut.contains({.src = u, .dst = v}) && reach.insert(v).second)
+	    todo.push_back(v);
+      }
+      S.clear();
+      for (const Node& t : T)
+	if (reach.contains(t))
+	  S.insert(t);
+    }
+    return S.empty();
+  }
+
+  // The graph and STs, with nodes numbered in order.
+  MinCutInstance instance(const std::string& name) const {
+    std::set<Node> nodes;
+    for (const auto& [src, dsts] : G) {
+      nodes.insert(src);
+      for (const auto& [dst, w] : dsts)
+	nodes.insert(dst);
+    }
+    for (const ST& st : sts)
+      for (const auto& group : st.waypoints)
+	nodes.insert(group.begin(), group.end());
+    const std::vector<Node> nodevec(nodes.begin(), nodes.end());
+    const auto idx = [&nodevec] (const Node& node) -> unsigned {
+      return llvm::lower_bound(nodevec, node) - nodevec.begin();
+    };
+
+    MinCutInstance I;
+    I.name = name;
+    I.nodes = nodevec.size();
+    for (const auto& [src, dsts] : G)
+      for (const auto& [dst, w] : dsts)
+	I.edges.push_back({.src = idx(src), .dst = idx(dst), .w = w});
+    for (const ST& st : sts) {
+      auto& ist = I.sts.emplace_back();
+      for (const auto& group : st.waypoints) {
+	auto& igroup = ist.emplace_back();
+	for (const Node& node : group)
+	  igroup.insert(idx(node));
+      }
+    }
+    return I;
+  }
+
 private:
 
 };
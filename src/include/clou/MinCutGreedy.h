@@ -2,14 +2,22 @@
 
 #include "MinCutBase.h"
 #include "clou/FordFulkerson.h"
+#include "clou/CSRGraph.h"
+#include "clou/ReachabilityIndex.h"
 
 #include <queue>
 #include <stack>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <set>
+#include <optional>
+#include <chrono>
 
 #include <llvm/ADT/SmallSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Clou/Clou.h>
 #include <llvm/ADT/STLExtras.h>
 
@@ -20,24 +28,125 @@
 namespace clou {
 
   template <class Node>
-  class MinCutGreedy final : public MinCutBase<Node, unsigned> {
+  class MinCutGreedy final : public MinCutBase<Node, Capacity> {
   public:
-    using Weight = unsigned;
+    using Weight = Capacity;
     using Super = MinCutBase<Node, Weight>;
     using Edge = typename Super::Edge;
     using ST = typename Super::ST;
 
   private:
     using Idx = unsigned;
+
+    /* A waypoint set: a sorted run of node indices in an STArena, together with a fingerprint of its contents. STs are
+     * then small vectors of these handles, which are cheap to copy, hash and compare.
+     */
+    struct IdxSet {
+      unsigned begin = 0;
+      unsigned size = 0;
+      uint64_t hash = 0;
+      bool empty() const { return size == 0; }
+    };
     struct IdxST {
-      std::vector<std::set<Idx>> waypoints;
-      bool operator<(const IdxST& o) const {
-	return waypoints < o.waypoints;
+      llvm::SmallVector<IdxSet, 3> waypoints;
+      uint64_t hash() const {
+	return llvm::hash_combine_range(llvm::map_iterator(waypoints.begin(), [] (const IdxSet& set) { return set.hash; }),
+					llvm::map_iterator(waypoints.end(), [] (const IdxSet& set) { return set.hash; }));
+      }
+    };
+
+    /* Storage for all waypoint sets. Sets only ever shrink in place; new ones (e.g., from joins) are appended, and
+     * compact() drops the ones no ST refers to anymore.
+     */
+    class STArena {
+    public:
+      llvm::ArrayRef<Idx> operator[](const IdxSet& set) const {
+	return llvm::ArrayRef(nodes).slice(set.begin, set.size);
+      }
+
+      // nodes must be sorted and unique.
+      template <class Range>
+      IdxSet add(const Range& sorted_nodes) {
+	IdxSet set = {.begin = static_cast<unsigned>(nodes.size())};
+	nodes.insert(nodes.end(), std::begin(sorted_nodes), std::end(sorted_nodes));
+	set.size = nodes.size() - set.begin;
+	set.hash = fingerprint((*this)[set]);
+	assert(std::is_sorted(nodes.begin() + set.begin, nodes.end()));
+	return set;
+      }
+
+      bool contains(const IdxSet& set, Idx u) const {
+	const auto elts = (*this)[set];
+	return std::binary_search(elts.begin(), elts.end(), u);
+      }
+
+      template <class Pred>
+      bool erase_if(IdxSet& set, Pred pred) {
+	const auto begin = nodes.begin() + set.begin;
+	const auto end = std::remove_if(begin, begin + set.size, pred);
+	if (end == begin + set.size)
+	  return false;
+	set.size = end - begin;
+	set.hash = fingerprint((*this)[set]);
+	return true;
+      }
+
+      // Applies a monotone renumbering to the set in place, so that it stays sorted.
+      template <class Func>
+      void renumber(IdxSet& set, Func func) {
+	for (Idx& u : llvm::MutableArrayRef(nodes).slice(set.begin, set.size))
+	  u = func(u);
+	set.hash = fingerprint((*this)[set]);
       }
-      bool operator==(const IdxST& o) const {
-	return waypoints == o.waypoints;
+
+      bool equal(const IdxSet& a, const IdxSet& b) const {
+	return a.hash == b.hash && (*this)[a] == (*this)[b];
+      }
+
+      bool equal(const IdxST& a, const IdxST& b) const {
+	return a.waypoints.size() == b.waypoints.size() &&
+	  llvm::all_of(llvm::zip(a.waypoints, b.waypoints), [&] (const auto& p) {
+	    return equal(std::get<0>(p), std::get<1>(p));
+	  });
+      }
+
+      // Lexicographic, as for std::vector<std::set<Idx>>.
+      bool less(const IdxST& a, const IdxST& b) const {
+	return std::lexicographical_compare(a.waypoints.begin(), a.waypoints.end(), b.waypoints.begin(), b.waypoints.end(),
+					    [&] (const IdxSet& x, const IdxSet& y) {
+					      const auto xs = (*this)[x], ys = (*this)[y];
+					      return std::lexicographical_compare(xs.begin(), xs.end(), ys.begin(), ys.end());
+					    });
+      }
+
+      std::vector<std::set<Idx>> sets(const IdxST& st) const {
+	std::vector<std::set<Idx>> sets;
+	for (const IdxSet& set : st.waypoints) {
+	  const auto elts = (*this)[set];
+	  sets.emplace_back(elts.begin(), elts.end());
+	}
+	return sets;
+      }
+
+      size_t size() const { return nodes.size(); }
+
+      // Moves the sets of sts into a fresh arena, dropping everything else.
+      void compact(std::vector<IdxST>& sts) {
+	STArena fresh;
+	for (IdxST& st : sts)
+	  for (IdxSet& set : st.waypoints)
+	    set = fresh.add((*this)[set]);
+	*this = std::move(fresh);
+      }
+
+      static uint64_t fingerprint(llvm::ArrayRef<Idx> elts) {
+	return llvm::hash_combine_range(elts.begin(), elts.end());
       }
+
+    private:
+      std::vector<Idx> nodes;
     };
+
     struct IdxEdge {
       Idx src, dst;
       // auto operator<=>(const IdxEdge& o) const = default;
@@ -51,12 +160,34 @@ namespace clou {
 	return pair() == o.pair();
       }
     };    
-    using IdxGraph = std::vector<std::map<Idx, Weight>>;
+    using IdxGraph = CSRGraph;
+
+    /* State shared by the per-ST optimizations: the reachability index is built once per optimize_sts(), and the
+     * scratch space is reused by the searches the index can't answer.
+     */
+    struct STOptContext {
+      const IdxGraph& G;
+      STArena& arena;
+      ReachabilityIndex index;
+      llvm::BitVector mask;
+      llvm::BitVector visited;
+      std::vector<Idx> todo;
+
+      STOptContext(const IdxGraph& G, STArena& arena):
+	G(G), arena(arena), index(G, reach_index_limit), visited(G.nodes(), false) {}
+
+      // Whether any node in the set is in the component mask.
+      bool any_in_mask(const IdxSet& set) const {
+	return llvm::any_of(arena[set], [&] (Idx v) {
+	  return mask.test(index.component(v));
+	});
+      }
+    };
 
     /* This optimization removes all the unreachable nodes in an s-t list.
      * Requires a follow-up pass to remove s-t lists containing an empty set.
      */
-    static bool optimize_sts_cull_unreachables(IdxST& st_, const std::vector<std::map<Idx, Weight>>& G) {
+    static bool optimize_sts_cull_unreachables(IdxST& st_, STOptContext& ctx) {
       auto& st = st_.waypoints;
       size_t removed = 0;
 
@@ -64,82 +195,105 @@ namespace clou {
 	const auto& S = *S_it;
 	auto& T = *T_it;
 
-	// Compute reach of S.
-	std::stack<Idx> todo;
-	for (Idx s : S)
-	  todo.push(s);
-	llvm::BitVector reach(G.size(), false);
-	while (!todo.empty()) {
-	  const Idx u = todo.top();
-	  todo.pop();
-	  for (const auto& [v, w] : G[u]) {
-	    if (reach.test(v))
-	      continue;
-	    reach.set(v);
-	    todo.push(v);
-	  }
-	}
-
 	// Remove any t's that aren't reached.
-	removed += std::erase_if(T, [&reach] (Idx v) {
-	  return !reach.test(v);
+	ctx.index.reach(ctx.arena[S], ctx.mask);
+	removed += ctx.arena.erase_if(T, [&ctx] (Idx v) {
+	  return !ctx.mask.test(ctx.index.component(v));
 	});
       }
 
       return removed > 0;
     }
 
-    static bool optimize_sts_cull_sources(IdxST& st_, const std::vector<std::map<Idx, Weight>>& G) {
+    /* This optimization removes the sources that can only reach T through other sources.
+     * Rather than searching forward from each source, search backward from T once, without passing through S.
+     */
+    static bool optimize_sts_cull_sources(IdxST& st_, STOptContext& ctx) {
+      const IdxGraph& G = ctx.G;
       bool changed = false;
       auto& st = st_.waypoints;
       for (auto S_it = st.begin(), T_it = std::next(S_it); T_it != st.end(); ++S_it, ++T_it) {
 	auto& S = *S_it;
 	const auto& T = *T_it;
 
-	// Compute reach of each s \in S.
-	for (auto s_it = S.begin(); s_it != S.end(); ) {
-	  std::stack<Idx> todo;
-	  todo.push(*s_it);
-	  llvm::BitVector reach(G.size(), false);
-	  bool reached_t = false;
-	  while (!todo.empty()) {
-	    const Idx u = todo.top();
-	    todo.pop();
-	    for (const auto& [v, w] : G[u]) {
-	      if (T.contains(v)) {
-		// We reached a sink, so we won't remove this source, thus we can exit prematurely.
-		reached_t = true;
-		goto done;
-	      }
-	      if (S.contains(v))
-		continue;
-	      if (reach.test(v))
-		continue;
-	      reach.set(v);
-	      todo.push(v);
-	    }
-	  }
+	// Sources that reach no t at all, or all of them if T is unreachable.
+	ctx.index.reach(ctx.arena[S], ctx.mask);
+	if (!ctx.any_in_mask(T)) {
+	  changed |= ctx.arena.erase_if(S, [] (Idx) { return true; });
+	  continue;
+	}
 
-	  done:
-	  if (reached_t) {
-	    ++s_it;
-	  } else {
-	    s_it = S.erase(s_it);
-	    changed = true;
+	auto& todo = ctx.todo;
+	auto& reach = ctx.visited;
+	const auto visit_preds = [&] (Idx v) {
+	  for (const Idx u : G.preds(v)) {
+	    if (reach.test(u))
+	      continue;
+	    reach.set(u);
+	    todo.push_back(u);
 	  }
+	};
+	for (Idx t : ctx.arena[T])
+	  visit_preds(t);
+	while (!todo.empty()) {
+	  const Idx v = todo.back();
+	  todo.pop_back();
+	  if (!ctx.arena.contains(S, v))
+	    visit_preds(v);
 	}
+
+	changed |= ctx.arena.erase_if(S, [&reach] (Idx s) {
+	  return !reach.test(s);
+	});
+	reach.reset();
       }
 
       return changed;
     }
 
+    /* This optimization removes the sinks that can only be reached from S through other sinks.
+     * The mirror image of optimize_sts_cull_sources: search forward from S once, without passing through T.
+     */
+    static bool optimize_sts_cull_sinks(IdxST& st_, STOptContext& ctx) {
+      const IdxGraph& G = ctx.G;
+      bool changed = false;
+      auto& st = st_.waypoints;
+      for (auto S_it = st.begin(), T_it = std::next(S_it); T_it != st.end(); ++S_it, ++T_it) {
+	const auto& S = *S_it;
+	auto& T = *T_it;
 
-    // TODO: optimize_sts_cull_sinks -- similar to *_soures
+	auto& todo = ctx.todo;
+	auto& reach = ctx.visited;
+	const auto visit_succs = [&] (Idx u) {
+	  for (const Idx v : G.succs(u)) {
+	    if (reach.test(v))
+	      continue;
+	    reach.set(v);
+	    todo.push_back(v);
+	  }
+	};
+	for (Idx s : ctx.arena[S])
+	  visit_succs(s);
+	while (!todo.empty()) {
+	  const Idx u = todo.back();
+	  todo.pop_back();
+	  if (!ctx.arena.contains(T, u))
+	    visit_succs(u);
+	}
+
+	changed |= ctx.arena.erase_if(T, [&reach] (Idx t) {
+	  return !reach.test(t);
+	});
+	reach.reset();
+      }
+
+      return changed;
+    }
 
-    static bool optimize_sts_remove_emptyset(std::vector<IdxST>& sts, [[maybe_unused]] const std::vector<std::map<Idx, Weight>>& G) {
+    static bool optimize_sts_remove_emptyset(std::vector<IdxST>& sts, [[maybe_unused]] STArena& arena) {
       auto end = sts.end();
       for (auto it = sts.begin(); it != end; ) {
-	const bool has_emptyset = llvm::any_of(it->waypoints, [] (const std::set<Idx>& s) {
+	const bool has_emptyset = llvm::any_of(it->waypoints, [] (const IdxSet& s) {
 	  return s.empty();
 	});
 	
@@ -157,7 +311,8 @@ namespace clou {
       return changed;
     }
 
-    static bool optimize_sts_remove_redundant_internal_st(IdxST& st_, const IdxGraph& G) {
+    static bool optimize_sts_remove_redundant_internal_st(IdxST& st_, STOptContext& ctx) {
+      const IdxGraph& G = ctx.G;
       auto& st = st_.waypoints;
 
       bool changed = false;
@@ -168,28 +323,39 @@ namespace clou {
 	const auto A_it = std::prev(B_it);
 	const auto C_it = std::next(B_it);
 
-	// Check if there's a path from A to C without hitting B.
-	std::stack<Idx> todo;
-	for (Idx a : *A_it)
-	  todo.push(a);
-	llvm::BitVector reach(G.size(), false);
-	while (!todo.empty()) {
-	  const Idx u = todo.top();
-	  todo.pop();
-	  for (const auto& [v, w] : G[u]) {
-	    if (B_it->contains(v))
-	      continue;
-	    if (reach.test(v))
-	      continue;
-	    reach.set(v);
-	    todo.push(v);
+	// If C isn't reachable from A at all, or B isn't, then the index already has the answer.
+	bool no_AC_path;
+	ctx.index.reach(ctx.arena[*A_it], ctx.mask);
+	if (!ctx.any_in_mask(*C_it)) {
+	  no_AC_path = true;
+	} else if (!ctx.any_in_mask(*B_it)) {
+	  no_AC_path = false;
+	} else {
+	  // Check if there's a path from A to C without hitting B.
+	  auto& todo = ctx.todo;
+	  auto& reach = ctx.visited;
+	  for (Idx a : ctx.arena[*A_it])
+	    todo.push_back(a);
+	  while (!todo.empty()) {
+	    const Idx u = todo.back();
+	    todo.pop_back();
+	    for (const Idx v : G.succs(u)) {
+	      if (ctx.arena.contains(*B_it, v))
+		continue;
+	      if (reach.test(v))
+		continue;
+	      reach.set(v);
+	      todo.push_back(v);
+	    }
 	  }
-	}
 
-	// If no c \in C is reached, then there exists no path directly from A to C. Therefore we can remove B entirely.
-	const bool no_AC_path = llvm::none_of(*C_it, [&] (Idx v) {
-	  return reach.test(v);
-	});
+	  // If no c \in C is reached, then there exists no path directly from A to C. Therefore we can remove B entirely.
+	  no_AC_path = llvm::none_of(ctx.arena[*C_it], [&] (Idx v) {
+	    return reach.test(v);
+	  });
+	  reach.reset();
+	}
+	
 	if (no_AC_path) {
 	  B_it = st.erase(B_it);
 	  changed = true;
@@ -201,20 +367,26 @@ namespace clou {
       return changed;
     }
 
-    static bool optimize_sts_remove_duplicates(std::vector<IdxST>& sts, [[maybe_unused]] const IdxGraph& G) {
+    /* Sorts the STs (so that the order they are solved in doesn't depend on how they were produced) and removes
+     * duplicates, which are adjacent after sorting and almost always told apart by their fingerprints alone.
+     */
+    static bool optimize_sts_remove_duplicates(std::vector<IdxST>& sts, STArena& arena) {
       const auto in_size = sts.size();
-      llvm::sort(sts);
-      sts.resize(std::unique(sts.begin(), sts.end()) - sts.begin());
+      llvm::sort(sts, [&arena] (const IdxST& a, const IdxST& b) {
+	return arena.less(a, b);
+      });
+      sts.erase(std::unique(sts.begin(), sts.end(), [&arena] (const IdxST& a, const IdxST& b) {
+	return arena.equal(a, b);
+      }), sts.end());
       const auto out_size = sts.size();
       return in_size != out_size;
     }
 
-    static bool optimize_sts_join(std::vector<IdxST>& sts, [[maybe_unused]] const IdxGraph& G) {
-
+    /* Joins STs that are the same except in one position, into one ST whose set in that position is the union of
+     * theirs. STs are bucketed by the fingerprints of their other positions, and only compared within a bucket.
+     */
+    static bool optimize_sts_join(std::vector<IdxST>& sts, STArena& arena) {
       const auto in_size = sts.size();
-      /* Idea: find pairs of STs that are the same except for one column. 
-       *
-       */
 
       // Sort them into pools based on their length.
       std::map<unsigned, std::vector<IdxST>> pools;
@@ -222,30 +394,56 @@ namespace clou {
 	pools[st.waypoints.size()].push_back(std::move(st));
       sts.clear();
 
+      std::unordered_map<uint64_t, llvm::SmallVector<unsigned, 1>> buckets; // key hash -> groups
+      std::vector<std::vector<unsigned>> groups; // members of each group, the first of which represents it
+      std::vector<Idx> joined;
       for (auto& [n, pool] : pools) {
-	using IdxSet = std::set<Idx>;
 	// Iterate over the positions.
 	for (unsigned i = 0; i < n; ++i) {
-	  // Construct shared map.
-	  std::map<std::vector<IdxSet>, IdxSet> sets;
-	  for (IdxST& st_ : pool) {
-	    auto& st = st_.waypoints;
-	    auto it = st.begin() + i;
-	    IdxSet set = std::move(*it);
-	    st.erase(it);
-	    sets[std::move(st)].merge(std::move(set));
+	  const auto same_except_i = [&] (const IdxST& a, const IdxST& b) {
+	    for (unsigned j = 0; j < n; ++j)
+	      if (j != i && !arena.equal(a.waypoints[j], b.waypoints[j]))
+		return false;
+	    return true;
+	  };
+
+	  buckets.clear();
+	  groups.clear();
+	  for (unsigned k = 0; k < pool.size(); ++k) {
+	    const IdxST& st = pool[k];
+	    uint64_t key = i;
+	    for (unsigned j = 0; j < n; ++j)
+	      if (j != i)
+		key = llvm::hash_combine(key, st.waypoints[j].hash);
+	    auto& bucket = buckets[key];
+	    const auto group_it = llvm::find_if(bucket, [&] (unsigned g) {
+	      return same_except_i(pool[groups[g].front()], st);
+	    });
+	    if (group_it == bucket.end()) {
+	      bucket.push_back(groups.size());
+	      groups.push_back({k});
+	    } else {
+	      groups[*group_it].push_back(k);
+	    }
 	  }
-	  pool.clear();
+	  if (groups.size() == pool.size())
+	    continue;
 
 	  // Reconstruct merged pool.
-	  for (auto it = sets.begin(); it != sets.end(); ) {
-	    const auto newit = std::next(it);
-	    auto nh = sets.extract(it);
-	    it = newit;
-	    std::vector<IdxSet>& st = pool.emplace_back().waypoints;
-	    st = std::move(nh.key());
-	    st.insert(st.begin() + i, std::move(nh.mapped()));
+	  std::vector<IdxST> merged;
+	  merged.reserve(groups.size());
+	  for (const auto& group : groups) {
+	    if (group.size() > 1) {
+	      joined.clear();
+	      for (unsigned k : group)
+		llvm::append_range(joined, arena[pool[k].waypoints[i]]);
+	      llvm::sort(joined);
+	      joined.erase(std::unique(joined.begin(), joined.end()), joined.end());
+	      pool[group.front()].waypoints[i] = arena.add(joined);
+	    }
+	    merged.push_back(std::move(pool[group.front()]));
 	  }
+	  pool = std::move(merged);
 	}
       }
 
@@ -257,19 +455,193 @@ namespace clou {
       return in_size != out_size;
     }
 
-    static bool optimize_st_nop(IdxST&, const IdxGraph&) { return false; }
-    static bool optimize_sts_nop(std::vector<IdxST>&, const IdxGraph&) { return false; }
+    /* Immediate dominators in G of the nodes reached from a virtual root n with an edge to each of roots, by Cooper,
+     * Harvey and Kennedy's iterative algorithm. idom[n] == n, unreached nodes get none, and rpo numbers the reached
+     * nodes (and the root, 0) in reverse postorder.
+     */
+    static constexpr Idx none = -1;
+    static void dominators(const IdxGraph& G, llvm::ArrayRef<Idx> roots, std::vector<Idx>& idom, std::vector<Idx>& rpo) {
+      const Idx n = G.nodes();
+      const Idx root = n;
+      idom.assign(n + 1, none);
+      rpo.assign(n + 1, none);
+
+      // Postorder by iterative DFS, from each of the root's successors in turn.
+      std::vector<Idx> order;
+      std::vector<std::pair<Idx, IdxGraph::node_iterator>> frames;
+      llvm::BitVector seen(n, false);
+      for (const Idx r : roots) {
+	if (seen.test(r))
+	  continue;
+	seen.set(r);
+	frames.emplace_back(r, G.succs(r).begin());
+	while (!frames.empty()) {
+	  auto& [u, it] = frames.back();
+	  if (it != G.succs(u).end()) {
+	    const Idx v = *it++;
+	    if (!seen.test(v)) {
+	      seen.set(v);
+	      frames.emplace_back(v, G.succs(v).begin());
+	    }
+	  } else {
+	    order.push_back(u);
+	    frames.pop_back();
+	  }
+	}
+      }
+      order.push_back(root);
+      std::reverse(order.begin(), order.end());
+      for (Idx i = 0; i < order.size(); ++i)
+	rpo[order[i]] = i;
+
+      llvm::BitVector is_root(n, false);
+      for (Idx u : roots)
+	is_root.set(u);
+      const auto intersect = [&] (Idx a, Idx b) {
+	while (a != b) {
+	  while (rpo[a] > rpo[b])
+	    a = idom[a];
+	  while (rpo[b] > rpo[a])
+	    b = idom[b];
+	}
+	return a;
+      };
+      idom[root] = root;
+      bool changed;
+      do {
+	changed = false;
+	for (Idx v : llvm::drop_begin(order)) {
+	  Idx new_idom = is_root.test(v) ? root : none;
+	  for (const Idx u : G.preds(v))
+	    if (idom[u] != none)
+	      new_idom = new_idom == none ? u : intersect(u, new_idom);
+	  if (idom[v] != new_idom) {
+	    idom[v] = new_idom;
+	    changed = true;
+	  }
+	}
+      } while (changed);
+    }
+
+    /* Dominance-based subsumption. Let (S1, T1) and (S2, T2) be two-set STs. If some s2 in S2 (but not in T1) dominates
+     * every reachable t1 in T1 with respect to S1, i.e., every path from S1 to T1 passes through s2, and every path from
+     * s2 to T1 passes through T2, then every S1-T1 path contains a path from s2 to T2, so any cut that separates
+     * (S2, T2) also separates (S1, T1), and the latter can be dropped. Dominators are computed once per distinct S1.
+     * An ST is only ever dropped in favor of one that is still there, so chains of subsumption end in a kept ST.
+     */
+    static bool optimize_sts_subsume(std::vector<IdxST>& sts, STOptContext& ctx) {
+      const IdxGraph& G = ctx.G;
+      const STArena& arena = ctx.arena;
+
+      // Two-set STs, by source and by S1.
+      std::unordered_map<Idx, std::vector<unsigned>> by_source;
+      std::unordered_map<uint64_t, std::vector<unsigned>> by_S;
+      for (unsigned i = 0; i < sts.size(); ++i) {
+	if (sts[i].waypoints.size() != 2)
+	  continue;
+	for (Idx s : arena[sts[i].waypoints[0]])
+	  by_source[s].push_back(i);
+	by_S[sts[i].waypoints[0].hash].push_back(i);
+      }
+
+      // Whether every path from s2 reaches T1 only through T2.
+      auto& todo = ctx.todo;
+      auto& reach = ctx.visited;
+      const auto blocks = [&] (Idx s2, const IdxSet& T2, const IdxSet& T1) {
+	bool blocked = true;
+	todo.push_back(s2);
+	while (blocked && !todo.empty()) {
+	  const Idx u = todo.back();
+	  todo.pop_back();
+	  for (const Idx v : G.succs(u)) {
+	    if (reach.test(v) || arena.contains(T2, v))
+	      continue;
+	    if (arena.contains(T1, v)) {
+	      blocked = false;
+	      break;
+	    }
+	    reach.set(v);
+	    todo.push_back(v);
+	  }
+	}
+	todo.clear();
+	reach.reset();
+	return blocked;
+      };
+
+      llvm::BitVector removed(sts.size(), false);
+      std::vector<Idx> idom, rpo;
+      const auto intersect = [&] (Idx x, Idx y) {
+	while (x != y) {
+	  while (rpo[x] > rpo[y])
+	    x = idom[x];
+	  while (rpo[y] > rpo[x])
+	    y = idom[y];
+	}
+	return x;
+      };
+      const auto subsumed = [&] (unsigned a) {
+	const IdxSet& T1 = sts[a].waypoints[1];
+
+	// The nearest common dominator of the reachable T1s; it and its dominators dominate them all.
+	Idx lca = none;
+	for (Idx t : arena[T1])
+	  if (idom[t] != none)
+	    lca = lca == none ? t : intersect(lca, t);
+	if (lca == none)
+	  return false;
+
+	for (Idx s2 = lca; s2 != G.nodes(); s2 = idom[s2]) {
+	  if (arena.contains(T1, s2))
+	    continue;
+	  const auto it = by_source.find(s2);
+	  if (it == by_source.end())
+	    continue;
+	  for (unsigned b : it->second)
+	    if (b != a && !removed.test(b) && blocks(s2, sts[b].waypoints[1], T1))
+	      return true;
+	}
+	return false;
+      };
+
+      for (auto& [hash, group] : by_S) {
+	// STs whose S1s merely share a fingerprint get their own dominators.
+	while (!group.empty()) {
+	  const IdxSet S1 = sts[group.front()].waypoints[0];
+	  dominators(G, arena[S1], idom, rpo);
+	  std::vector<unsigned> rest;
+	  for (unsigned a : group) {
+	    if (!arena.equal(sts[a].waypoints[0], S1))
+	      rest.push_back(a);
+	    else if (subsumed(a))
+	      removed.set(a);
+	  }
+	  group = std::move(rest);
+	}
+      }
+
+      if (removed.none())
+	return false;
+      unsigned k = 0;
+      for (unsigned i = 0; i < sts.size(); ++i)
+	if (!removed.test(i))
+	  sts[k++] = std::move(sts[i]);
+      sts.resize(k);
+      return true;
+    }
 
-    void optimize_sts(const std::vector<IdxST>& in_sts, std::vector<IdxST>& out_sts, const IdxGraph& G) const {
-      out_sts = in_sts;
+    static bool optimize_st_nop(IdxST&, STOptContext&) { return false; }
+    static bool optimize_sts_nop(std::vector<IdxST>&, STArena&) { return false; }
 
-      typedef bool (*optimize_st_t)(IdxST&, const IdxGraph&);
-      typedef bool (*optimize_sts_t)(std::vector<IdxST>&, const IdxGraph& G);
+    void optimize_sts(std::vector<IdxST>& sts, STArena& arena, const IdxGraph& G) const {
+      typedef bool (*optimize_st_t)(IdxST&, STOptContext&);
+      typedef bool (*optimize_sts_t)(std::vector<IdxST>&, STArena&);
       
       optimize_st_t local_opts[] = {
 	&MinCutGreedy::optimize_st_nop,
 	&MinCutGreedy::optimize_sts_cull_unreachables,
 	&MinCutGreedy::optimize_sts_cull_sources,
+	&MinCutGreedy::optimize_sts_cull_sinks,
 	&MinCutGreedy::optimize_sts_remove_redundant_internal_st
       };
 
@@ -283,31 +655,144 @@ namespace clou {
 	size_t count = 0;
 	for (const IdxST& st : sts)
 	  for (const auto& p : st.waypoints)
-	    count += p.size();
+	    count += p.size;
 	return count;
       };
 
-      [[maybe_unused]] const size_t in_size = compute_size(out_sts);
+      [[maybe_unused]] const size_t in_size = compute_size(sts);
       
+      STOptContext ctx(G, arena);
       bool changed;
       do {
 	changed = false;
 
-	changed |= optimize_sts_join(out_sts, G);
+	changed |= optimize_sts_join(sts, arena);
 	
-	for (IdxST& st : out_sts) 
+	for (IdxST& st : sts) 
 	  for (optimize_st_t local_opt : local_opts)
-	    changed |= local_opt(st, G);
+	    changed |= local_opt(st, ctx);
 	for (optimize_sts_t global_opt : global_opts)
-	  changed |= global_opt(out_sts, G);
+	  changed |= global_opt(sts, arena);
 
+	// Joins leave the sets they replaced behind.
+	if (arena.size() > 2 * compute_size(sts))
+	  arena.compact(sts);
       } while (changed);
+
+      // Dropping STs doesn't enable any of the other optimizations, so this only needs to run once.
+      if (subsume_min_cut_sts)
+	optimize_sts_subsume(sts, ctx);
       
-      [[maybe_unused]] const size_t out_size = compute_size(out_sts);
+      [[maybe_unused]] const size_t out_size = compute_size(sts);
+    }
+    
+    /* Series-parallel reduction of the graph. A node that is not a waypoint of any ST and has exactly one in-edge u->v
+     * and one out-edge v->w is replaced by an edge u->w weighing the smaller of the two, and parallel edges are merged
+     * by adding their weights. Neither changes the weight of any min cut, and straight-line runs of instructions
+     * collapse into single edges. Nodes are renumbered (sts are rewritten in place), and origins maps each forward arc
+     * of the returned graph to the original edges that cutting it stands for.
+     */
+    static IdxGraph condense(const IdxGraph& G, std::vector<IdxST>& sts, STArena& arena,
+			     std::vector<std::vector<IdxEdge>>& origins) {
+      const Idx n = G.nodes();
+      struct Entry {
+	uint64_t w;
+	std::vector<IdxEdge> origins;
+      };
+      std::vector<std::map<Idx, Entry>> succs(n);
+      std::vector<std::set<Idx>> preds(n);
+      for (Idx u = 0; u < n; ++u) {
+	for (const Idx v : G.succs(u)) {
+	  succs[u][v] = {.w = G.weight(G.at(u, v)), .origins = {{.src = u, .dst = v}}};
+	  preds[v].insert(u);
+	}
+      }
+
+      llvm::BitVector keep(n, false);
+      for (const IdxST& st : sts)
+	for (const IdxSet& waypoint_set : st.waypoints)
+	  for (Idx u : arena[waypoint_set])
+	    keep.set(u);
+
+      llvm::BitVector removed(n, false);
+      std::stack<Idx> todo;
+      for (Idx v = 0; v < n; ++v)
+	todo.push(v);
+      while (!todo.empty()) {
+	const Idx v = todo.top();
+	todo.pop();
+	if (keep.test(v) || removed.test(v) || preds[v].size() != 1 || succs[v].size() != 1)
+	  continue;
+	const Idx u = *preds[v].begin();
+	const Idx w = succs[v].begin()->first;
+	if (u == v || w == v || u == w)
+	  continue;
+
+	// Series: u->v->w becomes u->w. On ties, keep the earlier edge, which is where a cut would have gone anyway.
+	Entry in = std::move(succs[u].at(v));
+	Entry out = std::move(succs[v].at(w));
+	Entry& series = in.w <= out.w ? in : out;
+	succs[u].erase(v);
+	succs[v].clear();
+	preds[v].clear();
+	preds[w].erase(v);
+	removed.set(v);
+
+	// Parallel: merge with an existing u->w edge.
+	const auto [it, inserted] = succs[u].try_emplace(w, std::move(series));
+	if (!inserted) {
+	  Entry& parallel = it->second;
+	  parallel.w = merge_capacities(parallel.w, series.w);
+	  llvm::copy(series.origins, std::back_inserter(parallel.origins));
+	}
+	preds[w].insert(u);
+
+	todo.push(u);
+	todo.push(w);
+      }
+
+      // Renumber the remaining nodes.
+      std::vector<Idx> renumber(n);
+      Idx m = 0;
+      for (Idx u = 0; u < n; ++u)
+	if (!removed.test(u))
+	  renumber[u] = m++;
+      for (IdxST& st : sts)
+	for (IdxSet& waypoint_set : st.waypoints)
+	  arena.renumber(waypoint_set, [&renumber] (Idx u) { return renumber[u]; });
+
+      std::vector<IdxGraph::Edge> edges;
+      for (Idx u = 0; u < n; ++u)
+	for (const auto& [v, entry] : succs[u])
+	  edges.push_back({.src = renumber[u], .dst = renumber[v], .w = static_cast<Weight>(entry.w)});
+      IdxGraph H(m, edges);
+
+      origins.clear();
+      origins.resize(H.arcs());
+      for (Idx u = 0; u < n; ++u)
+	for (auto& [v, entry] : succs[u])
+	  origins[H.at(renumber[u], renumber[v])] = std::move(entry.origins);
+      return H;
     }
     
   public:
 
+    // Wall-clock budget for run(), in seconds. Once it runs out, run() stops after the first round and returns the best
+    // valid cut seen so far instead of iterating to a fixpoint.
+    std::optional<double> budget;
+
+    // Max-flow engine for the per-ST cuts; defaults to -clou-max-flow.
+    MaxFlowAlgorithm algorithm = max_flow_algorithm;
+
+    struct Quality {
+      uint64_t weight = 0; // of the returned cut
+      uint64_t lower_bound = 0; // on the weight of any valid cut: the largest min cut of a single ST
+      unsigned rounds = 0;
+      bool converged = false; // reached a fixpoint
+      bool budget_exhausted = false;
+    };
+    Quality quality;
+
     void run() override {
 #if 0
       // sort and de-duplicate sts
@@ -347,104 +832,228 @@ namespace clou {
       };
 
       // Get index graph.
-      IdxGraph G(nodes.size());
+      std::vector<IdxGraph::Edge> edges;
       for (const auto& [src, dsts] : this->G) {
 	const Idx isrc = node_to_idx(src);
-	auto& idsts = G[isrc];
-	for (const auto& [dst, w] : dsts) {
-	  const Idx idst = node_to_idx(dst);
-	  idsts[idst] = w;
-	}
+	for (const auto& [dst, w] : dsts)
+	  edges.push_back({.src = isrc, .dst = node_to_idx(dst), .w = w});
       }
+      IdxGraph G(nodes.size(), edges);
+      edges.clear();
 
-      // Get index sts.
+      // Get index sts. Nodes are sorted, so node_to_idx keeps each set sorted.
+      STArena arena;
       std::vector<IdxST> sts;
+      std::vector<Idx> iway;
       for (const ST& st : this->sts) {
 	auto& ist = sts.emplace_back();
 	for (const auto& way : st.waypoints) {
-	  auto& iway = ist.waypoints.emplace_back();
-	  llvm::transform(way, std::inserter(iway, iway.end()), node_to_idx);
+	  iway.clear();
+	  llvm::transform(way, std::back_inserter(iway), node_to_idx);
+	  ist.waypoints.push_back(arena.add(iway));
 	}
       }
 
-      {
-	std::vector<IdxST> opt_sts;
-	optimize_sts(sts, opt_sts, G);
-	sts = std::move(opt_sts);
-      }
+      optimize_sts(sts, arena, G);
+
+      // Solve on the condensed graph, and map its cut edges back to original edges at the end.
+      std::vector<std::vector<IdxEdge>> origins;
+      if (condense_min_cut_graph)
+	G = condense(G, sts, arena, origins);
 
       bool changed;
       enum class Mode {Replace, Augment} mode = Mode::Replace;
       using Cuts = std::vector<std::vector<IdxEdge>>;
-      using CutsHistory = std::set<Cuts>;
       Cuts cuts(sts.size());
+
+      /* Loop detection only needs to recognize a set of cuts seen before, so keep a fingerprint of each rather than a
+       * copy. A collision would only switch to Augment mode early, which still yields a valid cut.
+       */
+      using CutsHistory = std::unordered_set<uint64_t>;
       CutsHistory cuts_hist;
-      const IdxGraph OrigG = G; // mainly for checking weights
+      const auto cuts_fingerprint = [] (const Cuts& cuts) -> uint64_t {
+	llvm::hash_code hash = llvm::hash_value(cuts.size());
+	for (const auto& cut : cuts) {
+	  hash = llvm::hash_combine(hash, cut.size());
+	  for (const IdxEdge& e : cut)
+	    hash = llvm::hash_combine(hash, e.src, e.dst);
+	}
+	return hash;
+      };
+
+      // Each ST keeps its residual network between rounds, since most STs barely change from one round to the next.
+      std::vector<IncrementalMinCut> flows;
+      flows.reserve(sts.size());
+      for (const IdxST& st : sts)
+	flows.emplace_back(arena.sets(st), algorithm);
+      std::vector<unsigned> retained_sizes(sts.size(), 0);
+      size_t retained = 0;
+
+      /* Solves ST i against WG, in which its old cut (if restore_oldcut) is temporarily put back. WG is left as it was.
+       * This only touches WG and the ST's own IncrementalMinCut, so distinct STs can be solved concurrently.
+       */
+      const auto solve = [&] (size_t i, IdxGraph& WG, bool restore_oldcut) -> std::vector<IdxEdge> {
+	if (restore_oldcut)
+	  for (const IdxEdge& e : cuts[i])
+	    WG.restore(e.src, e.dst);
+	const auto& newcut_tmp = flows[i].solve(WG);
+	std::vector<IdxEdge> newcut(newcut_tmp.size());
+	llvm::transform(newcut_tmp, newcut.begin(), [] (const auto& p) -> IdxEdge {
+	  return {.src = p.first, .dst = p.second};
+	});
+	if (restore_oldcut)
+	  for (const IdxEdge& e : cuts[i])
+	    WG.remove(e.src, e.dst);
+	return newcut;
+      };
+
+      // Parallel mode solves batches of STs against the same graph, then merges their cuts.
+      const bool parallel = min_cut_threads > 1 && sts.size() > 1;
+      const size_t batch = parallel ? (min_cut_batch > 0 ? min_cut_batch : 4 * min_cut_threads) : 1;
+      std::optional<llvm::ThreadPool> pool;
+      std::vector<IdxGraph> workers;
+      if (parallel) {
+	pool.emplace(llvm::hardware_concurrency(min_cut_threads));
+	workers.resize(std::min<size_t>(min_cut_threads, batch), G);
+      }
+
+#if CHECK_CUTS
+      const IdxGraph OrigG = G;
+#endif
+
+      /* Anytime mode. The first round only ever adds cut edges, so its cut is valid, and so is every later round's that
+       * separates all STs; keep the lightest of those. Once the budget runs out, stop at the next ST and return it.
+       */
+      using BudgetClock = std::chrono::steady_clock;
+      const auto budget_start = BudgetClock::now();
+      const auto out_of_budget = [&] (double fraction = 1.) {
+	return budget && std::chrono::duration<double>(BudgetClock::now() - budget_start).count() >= *budget * fraction;
+      };
+      const auto cuts_weight = [&] (const Cuts& cuts) {
+	uint64_t weight = 0;
+	for (const auto& cut : cuts)
+	  for (const IdxEdge& e : cut)
+	    weight = saturating_add(weight, G.weight(G.at(e.src, e.dst)));
+	return weight;
+      };
+      std::optional<Cuts> best_cuts;
+      uint64_t best_weight = 0;
+      bool stop = false;
+      quality = Quality();
+      
       // constexpr unsigned limit = 10; // maximum number of iterations to perform before bailing
       // constexpr float timeout = 100000.; // 10 seconds
       clock_t clock_start = clock();
       do {
 	changed = false;
-
-	for (const auto& [st, cut] : llvm::zip(sts, cuts)) {
+	++quality.rounds;
+
+	for (size_t begin = 0; begin < sts.size(); begin += batch) {
+	  if (this->cancelled())
+	    return;
+	  if (best_cuts && out_of_budget()) {
+	    stop = true;
+	    break;
+	  }
 	  
-	  // Add old cut edges back in to graph.
-	  const auto oldcut = std::move(cut);
-	  if (mode == Mode::Replace) {
-	    for (const IdxEdge& e : oldcut) {
-	      const Weight w = OrigG[e.src].at(e.dst);
-	      [[maybe_unused]] const bool inserted = G[e.src].insert(std::make_pair(e.dst, w)).second;
-	      assert(inserted && "Cut edge still in graph G!");
+	  const size_t end = std::min(begin + batch, sts.size());
+	  std::vector<std::vector<IdxEdge>> solved(end - begin);
+	  if (parallel) {
+	    // Solve the whole batch against the current graph, each worker on its own copy of the cut mask.
+	    for (unsigned k = 0; k < workers.size(); ++k) {
+	      pool->async([&, k] {
+		IdxGraph& WG = workers[k];
+		WG.set_removed_edges(G.removed_edges());
+		for (size_t i = begin + k; i < end; i += workers.size())
+		  solved[i - begin] = solve(i, WG, mode == Mode::Replace);
+	      });
 	    }
+	    pool->wait();
+	  } else {
+	    solved[0] = solve(begin, G, mode == Mode::Replace);
 	  }
 
-	  // Compute new local min cut.
-	  const auto newcut_tmp = ford_fulkerson_multi(G, st.waypoints);
-	  std::vector<IdxEdge> newcut(newcut_tmp.size());
-	  llvm::transform(newcut_tmp, newcut.begin(), [] (const auto& p) -> IdxEdge {
-	    return {.src = p.first, .dst = p.second};
-	  });
-	  if (mode == Mode::Augment)
-	    llvm::copy(oldcut, std::back_inserter(newcut));
-	  llvm::sort(newcut);
-	  std::unique(newcut.begin(), newcut.end());
+	  // Merge in ST order, so that the result doesn't depend on scheduling.
+	  for (size_t i = begin; i < end; ++i) {
+	    [[maybe_unused]] const IdxST& st = sts[i];
+	    auto& cut = cuts[i];
+	    IncrementalMinCut& flow = flows[i];
+	    
+	    // Add old cut edges back in to graph.
+	    const auto oldcut = std::move(cut);
+	    if (mode == Mode::Replace) {
+	      for (const IdxEdge& e : oldcut) {
+		[[maybe_unused]] const bool restored = G.restore(e.src, e.dst);
+		assert(restored && "Cut edge still in graph G!");
+	      }
+	    }
+
+	    std::vector<IdxEdge> newcut = std::move(solved[i - begin]);
+	    retained += flow.size() - retained_sizes[i];
+	    retained_sizes[i] = flow.size();
+	    if (retained > min_cut_warm_start_limit) {
+	      retained -= flow.size();
+	      retained_sizes[i] = 0;
+	      flow.release();
+	    }
+	    if (mode == Mode::Augment)
+	      llvm::copy(oldcut, std::back_inserter(newcut));
+	    llvm::sort(newcut);
+	    std::unique(newcut.begin(), newcut.end());
 	  
 #if CHECK_CUTS
-	  {
-	    std::set<IdxEdge> cutset;
-	    llvm::copy(newcut, std::inserter(cutset, cutset.end()));
-	    checkCutST(st.waypoints, cutset, G);
-	  }
+	    {
+	      std::set<IdxEdge> cutset;
+	      llvm::copy(newcut, std::inserter(cutset, cutset.end()));
+	      checkCutST(arena.sets(st), cutset, G);
+	    }
 #endif
 
-	  // Remove new cut edges from G.
-	  for (const IdxEdge& e : newcut) {
-	    if (mode == Mode::Replace)
-	      assert(G.at(e.src).find(e.dst) != G.at(e.src).end());
-	    [[maybe_unused]] const auto erased = G[e.src].erase(e.dst);
-	    if (mode == Mode::Replace)
-	      assert(erased > 0);
-	  }
+	    // Remove new cut edges from G. In parallel mode, an earlier ST in the same batch may have already cut some
+	    // of them, in which case they stay with that ST.
+	    llvm::erase_if(newcut, [&] (const IdxEdge& e) {
+	      if (G.remove(e.src, e.dst))
+		return false;
+	      if (mode == Mode::Augment && std::binary_search(oldcut.begin(), oldcut.end(), e))
+		return false;
+	      assert(parallel && "Cut edge not in graph G!");
+	      return true;
+	    });
 
-	  // Check if changed.
-	  if (oldcut != newcut)
-	    changed = true;
+	    // Check if changed.
+	    if (oldcut != newcut)
+	      changed = true;
 
-	  // Update cut.
-	  cut = std::move(newcut);
+	    // Update cut.
+	    cut = std::move(newcut);
 
 #if CHECK_CUTS
-	  {
-	    std::set<IdxEdge> cutset;
-	    for (const auto& cutvec : cuts)
-	      llvm::copy(cutvec, std::inserter(cutset, cutset.end()));
-	    checkCutST(st.waypoints, cutset, OrigG);
+	    {
+	      std::set<IdxEdge> cutset;
+	      for (const auto& cutvec : cuts)
+		llvm::copy(cutvec, std::inserter(cutset, cutset.end()));
+	      checkCutST(arena.sets(st), cutset, OrigG);
+	    }
+#endif
+	  }
+	}
+
+	if (stop)
+	  break;
+	if (budget && (!changed || separates_all(sts, arena, G))) {
+	  const uint64_t weight = cuts_weight(cuts);
+	  if (!best_cuts || weight < best_weight) {
+	    best_cuts = cuts;
+	    best_weight = weight;
+	  }
+	  if (changed && out_of_budget()) {
+	    stop = true;
+	    break;
 	  }
-#endif	  
 	}
 
 	if (changed) {
-	  if (!cuts_hist.insert(cuts).second) {
+	  if (!cuts_hist.insert(cuts_fingerprint(cuts)).second) {
 	    assert(mode == Mode::Replace);
 	    llvm::WithColor::warning() << "detected loop in min-cut algorithm\n";
 	    mode = Mode::Augment;
@@ -470,15 +1079,43 @@ namespace clou {
 	
       } while (changed);
 
+      quality.converged = !stop;
+      quality.budget_exhausted = stop;
+      if (stop)
+	cuts = std::move(*best_cuts);
+      quality.weight = cuts_weight(cuts);
+
+      /* Lower bound: any valid cut also separates each ST on its own. This costs another solve per ST, so only do it in
+       * anytime mode, and let it overrun the budget by at most a tenth; every ST solved still gives a valid bound.
+       */
+      if (budget) {
+	IdxGraph FullG = G;
+	FullG.set_removed_edges(llvm::BitVector(G.arcs(), false));
+	for (const IdxST& st : sts) {
+	  if (out_of_budget(1.1) || this->cancelled())
+	    break;
+	  uint64_t st_weight = 0;
+	  for (const auto& [u, v] : ford_fulkerson_multi(FullG, arena.sets(st), algorithm))
+	    st_weight = saturating_add(st_weight, G.weight(G.at(u, v)));
+	  quality.lower_bound = std::max(quality.lower_bound, st_weight);
+	}
+      }
 
 #if CHECK_CUTS
-      checkCut(cuts, sts, OrigG);
+      checkCut(cuts, sts, arena, OrigG);
 #endif
 
       // Now add all cut edges to master copy.
-      for (const auto& cut : cuts)
-	for (const IdxEdge& e : cut)
-	  this->cut_edges.push_back({.src = idx_to_node(e.src), .dst = idx_to_node(e.dst)});
+      for (const auto& cut : cuts) {
+	for (const IdxEdge& e : cut) {
+	  if (condense_min_cut_graph) {
+	    for (const IdxEdge& orig : origins[G.at(e.src, e.dst)])
+	      this->cut_edges.push_back({.src = idx_to_node(orig.src), .dst = idx_to_node(orig.dst)});
+	  } else {
+	    this->cut_edges.push_back({.src = idx_to_node(e.src), .dst = idx_to_node(e.dst)});
+	  }
+	}
+      }
     }
     
   private:
@@ -488,8 +1125,7 @@ namespace clou {
       assert(st.size() >= 2);
       const auto succs = [&] (unsigned u) {
 	std::set<unsigned> succs;
-	for (const auto& [v, w] : G.at(u)) {
-	  assert(w > 0);
+	for (const Idx v : G.succs(u)) {
 	  const IdxEdge e = {.src = u, .dst = v};
 	  if (!cut.contains(e))
 	    succs.insert(v);
@@ -532,12 +1168,42 @@ namespace clou {
       }
     }
 
-    static void checkCut(llvm::ArrayRef<std::vector<IdxEdge>> cut, llvm::ArrayRef<IdxST> sts, const IdxGraph& G) {
+    // Whether G, with its cut edges removed, separates every ST.
+    static bool separates_all(llvm::ArrayRef<IdxST> sts, const STArena& arena, const IdxGraph& G) {
+      llvm::BitVector reach(G.nodes());
+      std::vector<Idx> todo;
+      for (const IdxST& st : sts) {
+	const auto S0 = arena[st.waypoints.front()];
+	std::vector<Idx> S(S0.begin(), S0.end());
+	for (const IdxSet& T : llvm::drop_begin(st.waypoints)) {
+	  reach.reset();
+	  todo = std::move(S);
+	  while (!todo.empty()) {
+	    const Idx u = todo.back();
+	    todo.pop_back();
+	    for (const Idx v : G.succs(u)) {
+	      if (!reach.test(v)) {
+		reach.set(v);
+		todo.push_back(v);
+	      }
+	    }
+	  }
+	  S.clear();
+	  llvm::copy_if(arena[T], std::back_inserter(S), [&reach] (Idx t) { return reach.test(t); });
+	}
+	if (!S.empty())
+	  return false;
+      }
+      return true;
+    }
+
+    static void checkCut(llvm::ArrayRef<std::vector<IdxEdge>> cut, llvm::ArrayRef<IdxST> sts, const STArena& arena,
+			 const IdxGraph& G) {
       std::set<IdxEdge> cutset;
       for (const auto& cutvec : cut)
 	llvm::copy(cutvec, std::inserter(cutset, cutset.end()));
       for (const IdxST& st : sts)
-	checkCutST(st.waypoints, cutset, G);
+	checkCutST(arena.sets(st), cutset, G);
     }
 
     static llvm::BitVector bvand(const llvm::BitVector& a, const llvm::BitVector& b) {
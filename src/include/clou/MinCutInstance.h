@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <optional>
+#include <istream>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "clou/CSRGraph.h"
+
+namespace clou {
+
+  /* A min-cut problem, detached from the IR it came from, so that solvers can be replayed and benchmarked outside of
+   * a compile. The format is line-based:
+   *
+   *   clou-min-cut 1
+   *   name <name>
+   *   nodes <n>
+   *   edges <m>
+   *   <src> <dst> <weight>      (m lines)
+   *   sts <k>
+   *   <sets> <size> <node>... <size> <node>...   (k lines, one per ST, waypoint sets in order)
+   */
+  struct MinCutInstance {
+    std::string name;
+    unsigned nodes = 0;
+    std::vector<CSRGraph::Edge> edges;
+    std::vector<std::vector<std::set<unsigned>>> sts;
+
+    static constexpr const char *header = "clou-min-cut 1";
+
+    void write(llvm::raw_ostream& os) const {
+      os << header << "\n";
+      os << "name " << name << "\n";
+      os << "nodes " << nodes << "\n";
+      os << "edges " << edges.size() << "\n";
+      for (const CSRGraph::Edge& e : edges)
+	os << e.src << " " << e.dst << " " << e.w << "\n";
+      os << "sts " << sts.size() << "\n";
+      for (const auto& st : sts) {
+	os << st.size();
+	for (const std::set<unsigned>& waypoint_set : st) {
+	  os << " " << waypoint_set.size();
+	  for (unsigned u : waypoint_set)
+	    os << " " << u;
+	}
+	os << "\n";
+      }
+    }
+
+    // Returns std::nullopt if the input is malformed.
+    static std::optional<MinCutInstance> read(std::istream& is) {
+      MinCutInstance I;
+      std::string line, key;
+      if (!std::getline(is, line) || line != header)
+	return std::nullopt;
+      if (!(is >> key) || key != "name")
+	return std::nullopt;
+      is >> std::ws;
+      std::getline(is, I.name);
+
+      size_t m, k;
+      if (!(is >> key >> I.nodes) || key != "nodes")
+	return std::nullopt;
+      if (!(is >> key >> m) || key != "edges")
+	return std::nullopt;
+      I.edges.resize(m);
+      for (CSRGraph::Edge& e : I.edges)
+	if (!(is >> e.src >> e.dst >> e.w) || e.src >= I.nodes || e.dst >= I.nodes)
+	  return std::nullopt;
+      if (!(is >> key >> k) || key != "sts")
+	return std::nullopt;
+      I.sts.resize(k);
+      for (auto& st : I.sts) {
+	size_t sets;
+	if (!(is >> sets))
+	  return std::nullopt;
+	st.resize(sets);
+	for (std::set<unsigned>& waypoint_set : st) {
+	  size_t size;
+	  if (!(is >> size))
+	    return std::nullopt;
+	  for (size_t i = 0; i < size; ++i) {
+	    unsigned u;
+	    if (!(is >> u) || u >= I.nodes)
+	      return std::nullopt;
+	    waypoint_set.insert(u);
+	  }
+	}
+      }
+      return I;
+    }
+  };
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include <llvm/Support/WithColor.h>
+
+#include "clou/MinCutBase.h"
+#include "clou/Capacity.h"
+
+namespace clou {
+
+  /* Runs several min-cut backends on the same problem concurrently and keeps the lightest valid cut. The race ends
+   * once an exact backend has proven its cut optimal, once every backend has finished, or once the budget has run out
+   * and at least one valid cut is in; the backends still running are then cancelled. Backends get copies of G and the
+   * STs, and are otherwise configured (budgets, timeouts, flow engines) by the caller before being added.
+   */
+  template <class Node>
+  class MinCutPortfolio final : public MinCutBase<Node, Capacity> {
+  public:
+    using Weight = Capacity;
+    using Super = MinCutBase<Node, Weight>;
+    using Edge = typename Super::Edge;
+    using ST = typename Super::ST;
+    using Backend = Super;
+
+    // Wall-clock seconds after which to settle for the best valid cut in so far.
+    std::optional<double> budget;
+
+    struct Outcome {
+      std::string name;
+      bool finished = false; // rather than cancelled
+      bool valid = false; // its cut separates all STs
+      bool complete = false; // the backend considers its cut final (converged, or proven optimal)
+      uint64_t weight = 0;
+      double seconds = 0;
+    };
+    std::vector<Outcome> outcomes; // in the order the backends were added
+    std::optional<size_t> winner; // index into outcomes
+
+    /* complete is asked after the backend's run() returns whether it got all the way; exact says that a complete cut
+     * is also optimal, so that the race can stop there.
+     */
+    void add(const std::string& name, std::unique_ptr<Backend> backend, std::function<bool ()> complete, bool exact = false) {
+      backends.push_back({.backend = std::move(backend), .complete = std::move(complete), .exact = exact});
+      outcomes.push_back({.name = name});
+    }
+
+    void run() override {
+      using Clock = std::chrono::steady_clock;
+      const auto start = Clock::now();
+      const auto elapsed = [&start] {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+      };
+
+      std::atomic<bool> cancel_all = false;
+      std::mutex mutex;
+      std::condition_variable cv;
+      unsigned running = backends.size();
+      bool optimal = false;
+
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < backends.size(); ++i) {
+	Backend& backend = *backends[i].backend;
+	backend.G = this->G;
+	for (const ST& st : this->sts)
+	  backend.add_st_list(st.waypoints);
+	backend.cancel = &cancel_all;
+
+	threads.emplace_back([&, i] {
+	  Entry& entry = backends[i];
+	  Outcome& outcome = outcomes[i];
+	  entry.backend->run();
+	  const double seconds = elapsed();
+
+	  Outcome result = outcome;
+	  result.seconds = seconds;
+	  if (!entry.backend->cancelled()) {
+	    result.finished = true;
+	    result.complete = entry.complete();
+	    const std::set<Edge> cut(entry.backend->cut_edges.begin(), entry.backend->cut_edges.end());
+	    result.valid = llvm::all_of(this->sts, [&] (const ST& st) {
+	      return this->separates(st, cut);
+	    });
+	    for (const Edge& e : cut)
+	      result.weight = saturating_add(result.weight, this->G.at(e.src).at(e.dst));
+	  }
+
+	  std::scoped_lock lock(mutex);
+	  outcome = result;
+	  if (result.valid && result.complete && entry.exact)
+	    optimal = true;
+	  --running;
+	  cv.notify_all();
+	});
+      }
+
+      // Wait for the race to be decided.
+      {
+	std::unique_lock lock(mutex);
+	const auto decided = [&] {
+	  return optimal || running == 0 || (budget && elapsed() >= *budget && llvm::any_of(outcomes, [] (const Outcome& o) {
+	    return o.valid;
+	  }));
+	};
+	while (!decided()) {
+	  if (budget && elapsed() < *budget)
+	    cv.wait_until(lock, start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(*budget)));
+	  else
+	    cv.wait(lock);
+	}
+      }
+
+      cancel_all = true;
+      for (Entry& entry : backends)
+	entry.backend->interrupt();
+      for (std::thread& thread : threads)
+	thread.join();
+
+      // Lightest valid cut; ties go to the backend added first.
+      for (size_t i = 0; i < outcomes.size(); ++i)
+	if (outcomes[i].valid && (!winner || outcomes[i].weight < outcomes[*winner].weight))
+	  winner = i;
+      if (!winner) {
+	llvm::WithColor::warning() << "min-cut portfolio: no backend found a valid cut\n";
+	return;
+      }
+      this->cut_edges = backends[*winner].backend->cut_edges;
+    }
+
+  private:
+    struct Entry {
+      std::unique_ptr<Backend> backend;
+      std::function<bool ()> complete;
+      bool exact;
+    };
+    std::vector<Entry> backends;
+  };
+
+}
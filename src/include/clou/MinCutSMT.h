@@ -3,6 +3,11 @@
 #include <map>
 #include <vector>
 #include <cstdlib>
+#include <optional>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
 
 #include <z3++.h>
 
@@ -14,7 +19,37 @@
 
 namespace clou {
 
-  constexpr bool mincut_optimize_collapse = true;
+  /* The Z3 context a run() is blocked in, so that MinCutBase::interrupt() can stop it from another thread. Attaching
+   * after cancellation has been requested interrupts right away, so the request can't be lost in between.
+   */
+  class Z3Interrupt {
+  public:
+    class Scope {
+    public:
+      Scope(Z3Interrupt& I, z3::context& ctx, const std::atomic<bool> *cancel): I(I) {
+	std::scoped_lock lock(I.mutex);
+	I.ctx = &ctx;
+	if (cancel && cancel->load())
+	  ctx.interrupt();
+      }
+      ~Scope() {
+	std::scoped_lock lock(I.mutex);
+	I.ctx = nullptr;
+      }
+    private:
+      Z3Interrupt& I;
+    };
+
+    void interrupt() {
+      std::scoped_lock lock(mutex);
+      if (ctx)
+	ctx->interrupt();
+    }
+
+  private:
+    std::mutex mutex;
+    z3::context *ctx = nullptr;
+  };
 
   template <class Node, class Weight>
   class MinCutSMT_Base : public MinCutBase<Node, Weight> {
@@ -41,11 +76,10 @@ namespace clou {
     }
 
     void simplifyGraph(Graph& G, Graph& Grev) {
-      std::set<Node> sources, transmitters;
-      for (const ST& st : this->sts) {
-	sources.insert(st.s);
-	transmitters.insert(st.t);
-      }
+      std::set<Node> waypoints;
+      for (const ST& st : this->sts)
+	for (const auto& group : st.waypoints)
+	  waypoints.insert(group.begin(), group.end());
 
       bool changed;
       do {
@@ -53,7 +87,7 @@ namespace clou {
 
 	// Elide any nodes with singleton same-weight in and out edges
 	for (const auto& [node, _] : G) {
-	  if (!sources.contains(node) && !transmitters.contains(node)) {
+	  if (!waypoints.contains(node)) {
 	    auto& succs = G[node];
 	    auto& preds = Grev[node];
 	    if (succs.size() == 1 && preds.size() == 1) {
@@ -74,7 +108,8 @@ namespace clou {
 	// Insert edges that we know must be placed
 	for (const auto& [src, dsts] : G) {
 	  for (const auto& [dst, _] : dsts) {
-	    ST st = {.s = src, .t = dst};
+	    ST st;
+	    st.waypoints = {{src}, {dst}};
 	    if (std::find(this->sts.begin(), this->sts.end(), st) != this->sts.end()) {
 	      removeEdge(G, Grev, src, dst);
 	      this->cut_edges.push_back({.src = src, .dst = dst});
@@ -87,8 +122,18 @@ namespace clou {
       } while (changed);
     }
 
+    // Give up (leaving optimal unset) after this many milliseconds, rather than failing.
+    std::optional<unsigned> timeout_ms;
+    bool optimal = false; // run() found an optimal cut
+    uint64_t optimal_weight = 0;
+
+    void interrupt() final {
+      z3_interrupt.interrupt();
+    }
+
     void run() final {
       if (this->sts.empty()) {
+	optimal = true;
 	return;
       }
       
@@ -110,16 +155,36 @@ namespace clou {
 	for (const auto& [dst, _] : dsts)
 	  add_id(dst);
       }
-
-      // Collect sources and transmitters
-      std::map<Node, size_t> sources;
-      assign_taint_ids(std::inserter(sources, sources.end()));
-      std::set<size_t> source_ids;
-      for (const auto& [_, source_id] : sources)
-	source_ids.insert(source_id);
-      std::set<Node> transmitters;
+      for (const ST& st : this->sts)
+	for (const auto& group : st.waypoints)
+	  for (const Node& node : group)
+	    add_id(node);
+
+      /* Taint tokens. Token i stands for "has visited the waypoint sets of some ST in order up to level l". STs with the
+       * same first l+1 waypoint sets share the token, so it is keyed by that prefix. A node emits the level-0 token if it
+       * is in the first set, and the level-l token if it is in the l-th set and receives the level-(l-1) token; tokens
+       * flow along uncut edges. An ST is cut iff no node in its last set receives its second-to-last token.
+       */
+      std::map<std::vector<std::set<Node>>, std::size_t> tokens;
+      struct Emit {
+	std::size_t token;
+	std::optional<std::size_t> requires_token; // token that must be received to emit this one
+      };
+      std::map<Node, std::vector<Emit>> emits;
+      std::vector<std::pair<Node, std::size_t>> forbidden; // (node, token it must not receive)
       for (const ST& st : this->sts) {
-	transmitters.insert(st.t);
+	std::vector<std::set<Node>> prefix;
+	std::optional<std::size_t> prev;
+	for (const auto& group : llvm::ArrayRef(st.waypoints).drop_back()) {
+	  prefix.push_back(group);
+	  const auto [it, inserted] = tokens.emplace(prefix, tokens.size());
+	  if (inserted)
+	    for (const Node& node : group)
+	      emits[node].push_back({.token = it->second, .requires_token = prev});
+	  prev = it->second;
+	}
+	for (const Node& node : st.waypoints.back())
+	  forbidden.emplace_back(node, *prev);
       }
 
       // for debugging
@@ -129,15 +194,12 @@ namespace clou {
 	for (const auto& [node, id] : ids) {
 	  llvm::errs() << "  " << node << " --> " << id << "\n";
 	}
-	llvm::errs() << "source index mapping:\n";
-	for (const auto& [source, id] : sources) {
-	  llvm::errs() << "  " << source << " --> " << id << "\n";
-	}
       }
 #endif
       
       z3::context ctx;
-      z3::expr empty_set = get_empty_set(ctx, source_ids.size());
+      const Z3Interrupt::Scope interrupt_scope(z3_interrupt, ctx, this->cancel);
+      z3::expr empty_set = get_empty_set(ctx, std::max<std::size_t>(tokens.size(), 1));
       z3::sort set_sort = empty_set.get_sort();
 
       // Variable name generators
@@ -167,6 +229,11 @@ namespace clou {
       
       // Construct graph
       z3::optimize solver(ctx);
+      if (timeout_ms) {
+	z3::params params(ctx);
+	params.set("timeout", *timeout_ms);
+	solver.set(params);
+      }
 
       // Define set-in's
       for (const auto& [dst, _] : ids) {
@@ -183,15 +250,21 @@ namespace clou {
       // Define set-out's
       for (const auto& [node, _] : ids) {
 	z3::expr set_out = set_in_var(node);
-	if (sources.contains(node)) {
-	  set_out = set_add(set_out, sources.at(node));
+	if (const auto it = emits.find(node); it != emits.end()) {
+	  for (const Emit& emit : it->second) {
+	    const z3::expr added = set_add(set_out, emit.token);
+	    if (emit.requires_token)
+	      set_out = z3::ite(set_member(set_in_var(node), *emit.requires_token), added, set_out);
+	    else
+	      set_out = added;
+	  }
 	}
 	solver.add(set_out == set_out_var(node));
       }
 
-      // Assert that transmitters never recieve a set containing their sources
-      for (const ST& st : this->sts) {
-	solver.add(!set_member(set_in_var(st.t), sources.at(st.s)));
+      // Assert that the last waypoints never receive the token of the waypoints before them
+      for (const auto& [node, token] : forbidden) {
+	solver.add(!set_member(set_in_var(node), token));
       }
 
       // Minimize cut weights
@@ -210,10 +283,14 @@ namespace clou {
       const z3::check_result check_res = solver.check();
       switch (check_res) {
       case z3::sat:
+	optimal = true;
 	break;
 
-      case z3::unsat:
       case z3::unknown:
+	if (timeout_ms || this->cancelled())
+	  return;
+	[[fallthrough]];
+      case z3::unsat:
 #if 0
 	for (const z3::expr& e : solver.assertions()) {
 	  std::cerr << e.simplify() << "\n";
@@ -224,6 +301,7 @@ namespace clou {
       }
 
       z3::model model = solver.get_model();
+      optimal_weight = model.eval(z3::sum(cut_weights)).get_numeral_uint64();
 
       // Collect cut edges
       for (const auto& [src, dsts] : this->G) {
@@ -242,51 +320,7 @@ namespace clou {
     virtual z3::expr set_member(const z3::expr& set, size_t i) const = 0;
 
   private:
-    template <class OutputIt>
-    OutputIt assign_taint_ids_collapse(OutputIt out) {
-      std::map<Node, std::set<Node>> s_ts, t_ss;
-      for (const auto& st : this->sts) {
-	s_ts[st.s].insert(st.t);
-	t_ss[st.t].insert(st.s);
-      }
-
-      std::map<std::set<Node>, std::set<Node>> ts_to_ss, ss_to_ts;
-      for (const auto& [s, ts] : s_ts)
-	ts_to_ss[ts].insert(s);
-      for (const auto& [t, ss] : t_ss)
-	ss_to_ts[ss].insert(t);
-
-      std::set<std::set<Node>> gsrcs, gsinks;
-      for (const auto& [_, ss] : ts_to_ss)
-	gsrcs.insert(ss);
-      for (const auto& [_, ts] : ss_to_ts)
-	gsinks.insert(ts);
-
-      for (unsigned i = 0; const auto& gsrc : gsrcs) {
-	for (const auto& src : gsrc)
-	  *out++ = std::make_pair(src, i);
-	++i;
-      }
-
-      // TODO: add validation?
-      return out;
-    }
-    
-    template <class OutputIt>
-    OutputIt assign_taint_ids(OutputIt out) {
-      if (mincut_optimize_collapse) {
-	return assign_taint_ids_collapse(out);
-      } else {
-	std::set<Node> sources;
-	for (const auto& st : this->sts)
-	  sources.insert(st.s);
-	for (unsigned i = 0; const auto& source : sources) {
-	  *out++ = std::make_pair(source, i);
-	  ++i;
-	}
-	return out;
-      }
-    }
+    Z3Interrupt z3_interrupt;
   };
 
   template <class Node, class Weight>
@@ -338,4 +372,189 @@ namespace clou {
     }
   };
   
+  /* Exact min cut that asserts STs lazily. Starting from no STs, it solves for the cheapest cut, looks for an ST that
+   * the cut doesn't separate, asserts that ST's taint encoding, and repeats. STs that end up separated as a side effect
+   * of cutting other STs are never encoded. Taint sets are bit-blasted into one Bool per node and token (rather than a
+   * bit-vector per node, whose width would have to be known up front), and the objective is a set of soft constraints,
+   * so that Z3 can use its MaxSAT engine and keep its state across iterations.
+   */
+  template <class Node, class Weight>
+  class MinCutSMT_CEGAR final : public MinCutBase<Node, Weight> {
+  public:
+    using Super = MinCutBase<Node, Weight>;
+    using Edge = typename Super::Edge;
+    using ST = typename Super::ST;
+
+    // Give up (leaving optimal unset) after this many milliseconds in total, rather than failing.
+    std::optional<unsigned> timeout_ms;
+    bool optimal = false;
+    uint64_t optimal_weight = 0;
+    unsigned iterations = 0;
+    unsigned encoded_sts = 0;
+
+    void interrupt() final {
+      z3_interrupt.interrupt();
+    }
+
+    void run() final {
+      // Name nodes and edges
+      std::map<Node, unsigned> ids;
+      const auto add_id = [&] (const Node& node) {
+	ids.emplace(node, ids.size());
+      };
+      for (const auto& [src, dsts] : this->G) {
+	add_id(src);
+	for (const auto& [dst, _] : dsts)
+	  add_id(dst);
+      }
+      for (const ST& st : this->sts)
+	for (const auto& group : st.waypoints)
+	  for (const Node& node : group)
+	    add_id(node);
+      const unsigned n = ids.size();
+      
+      std::vector<Node> nodes(n);
+      for (const auto& [node, id] : ids)
+	nodes[id] = node;
+      std::vector<std::vector<std::pair<unsigned, Weight>>> succs(n);
+      for (const auto& [src, dsts] : this->G)
+	for (const auto& [dst, w] : dsts)
+	  succs[ids.at(src)].emplace_back(ids.at(dst), w);
+
+      z3::context ctx;
+      const Z3Interrupt::Scope interrupt_scope(z3_interrupt, ctx, this->cancel);
+      z3::optimize solver(ctx);
+      const auto start = std::chrono::steady_clock::now();
+
+      const auto cut_var = [&] (unsigned u, unsigned v) {
+	std::stringstream ss;
+	ss << u << "-" << v << "-cut";
+	return ctx.bool_const(ss.str().c_str());
+      };
+      // add_soft() takes unsigned weights, which would truncate capacities, so minimize an integer sum instead.
+      z3::expr_vector cut_weights(ctx);
+      cut_weights.push_back(ctx.int_val(0));
+      for (unsigned u = 0; u < n; ++u)
+	for (const auto& [v, w] : succs[u])
+	  if (w > 0)
+	    cut_weights.push_back(z3::ite(cut_var(u, v), ctx.int_val(static_cast<uint64_t>(w)), ctx.int_val(0)));
+      solver.minimize(z3::sum(cut_weights));
+
+      /* Token i means "has visited the waypoint sets tokens[i] in order"; see MinCutSMT_Base. Each token gets a Bool
+       * per node saying whether it can reach the node over uncut edges.
+       */
+      std::map<std::vector<std::set<Node>>, unsigned> tokens;
+      const auto in_var = [&] (unsigned node, unsigned token) {
+	std::stringstream ss;
+	ss << node << "-" << token << "-in";
+	return ctx.bool_const(ss.str().c_str());
+      };
+      const auto encode_st = [&] (const ST& st) {
+	std::vector<std::set<Node>> prefix;
+	std::optional<unsigned> prev;
+	for (const auto& group : llvm::ArrayRef(st.waypoints).drop_back()) {
+	  prefix.push_back(group);
+	  const auto [it, inserted] = tokens.emplace(prefix, tokens.size());
+	  const unsigned token = it->second;
+	  if (inserted) {
+	    for (unsigned u = 0; u < n; ++u) {
+	      z3::expr out = in_var(u, token);
+	      if (group.contains(nodes[u]))
+		out = out || (prev ? in_var(u, *prev) : ctx.bool_val(true));
+	      for (const auto& [v, w] : succs[u])
+		solver.add(z3::implies(out && !cut_var(u, v), in_var(v, token)));
+	    }
+	  }
+	  prev = token;
+	}
+	for (const Node& node : st.waypoints.back())
+	  solver.add(!in_var(ids.at(node), *prev));
+	++encoded_sts;
+      };
+
+      std::vector<bool> encoded(this->sts.size(), false);
+      std::set<std::pair<unsigned, unsigned>> cut;
+      while (true) {
+	++iterations;
+	if (timeout_ms) {
+	  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	  if (elapsed.count() >= *timeout_ms)
+	    return;
+	  z3::params params(ctx);
+	  params.set("timeout", static_cast<unsigned>(*timeout_ms - elapsed.count()));
+	  solver.set(params);
+	}
+	switch (solver.check()) {
+	case z3::sat:
+	  break;
+	case z3::unknown:
+	  if (timeout_ms || this->cancelled())
+	    return;
+	  [[fallthrough]];
+	case z3::unsat:
+	  llvm::WithColor(llvm::errs(), llvm::HighlightColor::Error) << "internal error: Z3 min-cut query failed\n";
+	  std::_Exit(EXIT_FAILURE);
+	}
+
+	const z3::model model = solver.get_model();
+	cut.clear();
+	optimal_weight = 0;
+	for (unsigned u = 0; u < n; ++u) {
+	  for (const auto& [v, w] : succs[u]) {
+	    if (model.eval(cut_var(u, v)).is_true()) {
+	      cut.emplace(u, v);
+	      optimal_weight += w;
+	    }
+	  }
+	}
+
+	// Find an ST that the cut doesn't separate.
+	const auto separated = [&] (const ST& st) {
+	  std::vector<bool> reach;
+	  std::vector<unsigned> S, todo;
+	  for (const Node& node : st.waypoints.front())
+	    S.push_back(ids.at(node));
+	  for (const auto& T : llvm::ArrayRef(st.waypoints).drop_front()) {
+	    reach.assign(n, false);
+	    todo = std::move(S);
+	    while (!todo.empty()) {
+	      const unsigned u = todo.back();
+	      todo.pop_back();
+	      for (const auto& [v, w] : succs[u]) {
+		if (!reach[v] && !cut.contains({u, v})) {
+		  reach[v] = true;
+		  todo.push_back(v);
+		}
+	      }
+	    }
+	    S.clear();
+	    for (const Node& node : T)
+	      if (reach[ids.at(node)])
+		S.push_back(ids.at(node));
+	  }
+	  return S.empty();
+	};
+	bool refined = false;
+	for (size_t i = 0; i < this->sts.size(); ++i) {
+	  if (!encoded[i] && !separated(this->sts[i])) {
+	    encode_st(this->sts[i]);
+	    encoded[i] = true;
+	    refined = true;
+	  }
+	}
+	if (!refined)
+	  break;
+	if (this->cancelled())
+	  return;
+      }
+
+      optimal = true;
+      for (const auto& [u, v] : cut)
+	this->cut_edges.push_back({.src = nodes[u], .dst = nodes[v]});
+    }
+
+  private:
+    Z3Interrupt z3_interrupt;
+  };
+  
 }
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+#include <llvm/IR/Value.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/ValueTracking.h>
+
+namespace clou {
+
+  /* Memory accesses bucketed by the identified object (alloca, global, noalias call or noalias argument) their pointer
+   * is based on. BasicAA, which is always in the AA chain, says NoAlias to pointers based on distinct identified
+   * objects, so the only accesses that may alias a pointer are those in its own object's bucket and those whose object
+   * isn't identified -- or all of them, if the pointer's object isn't identified. Use this to skip alias queries whose
+   * answer is already known, without changing the results.
+   */
+  template <class T>
+  class ObjectPartition {
+  public:
+    // Mirrors BasicAA's own lookup, so that we never find distinct objects where it doesn't.
+    static const llvm::Value *getIdentifiedObject(const llvm::Value *P) {
+      if (P == nullptr)
+	return nullptr;
+      const llvm::Value *O = llvm::getUnderlyingObject(P->stripPointerCastsForAliasAnalysis());
+      return llvm::isIdentifiedObject(O) ? O : nullptr;
+    }
+
+    void insert(const llvm::Value *P, const T& x) {
+      all.push_back(x);
+      if (const llvm::Value *O = getIdentifiedObject(P))
+	objects[O].push_back(x);
+      else
+	unidentified.push_back(x);
+    }
+
+    // Calls f on every access that may alias P.
+    template <class Func>
+    void for_each_candidate(const llvm::Value *P, Func f) const {
+      if (const llvm::Value *O = getIdentifiedObject(P)) {
+	const auto it = objects.find(O);
+	if (it != objects.end())
+	  for (const T& x : it->second)
+	    f(x);
+	for (const T& x : unidentified)
+	  f(x);
+      } else {
+	for (const T& x : all)
+	  f(x);
+      }
+    }
+
+    const std::vector<T>& getAll() const { return all; }
+
+  private:
+    std::vector<T> all;
+    llvm::DenseMap<const llvm::Value *, std::vector<T>> objects;
+    std::vector<T> unidentified;
+  };
+
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <stack>
+#include <utility>
+#include <cassert>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/STLExtras.h>
+
+#include "clou/CSRGraph.h"
+
+namespace clou {
+
+  /* Reachability over the live edges of a CSRGraph, answered from its condensation into strongly connected components.
+   * Components are numbered in reverse topological order (Tarjan's order), so every DAG edge goes from a higher to a
+   * lower component. If there are at most closure_limit components, each one also gets a bitset of the components
+   * reachable from it by a nonempty path; otherwise reach() walks the (much smaller) DAG instead.
+   * remove() keeps the index in sync with edges cut from the graph.
+   */
+  class ReachabilityIndex {
+  public:
+    using Node = CSRGraph::Node;
+    using Component = unsigned;
+
+    ReachabilityIndex(const CSRGraph& G, unsigned closure_limit): G(G), closure_limit(closure_limit) {
+      build();
+    }
+
+    unsigned components() const { return succs.size(); }
+    Component component(Node u) const { return comps[u]; }
+
+    // Components reachable by a nonempty path from any of the nodes in srcs.
+    template <class Range>
+    void reach(const Range& srcs, llvm::BitVector& out) const {
+      out.clear();
+      out.resize(components(), false);
+      if (has_closure()) {
+	for (Node s : srcs)
+	  out |= closure[comps[s]];
+	return;
+      }
+
+      std::vector<Component> todo;
+      const auto visit = [&] (Component c) {
+	if (!out.test(c)) {
+	  out.set(c);
+	  todo.push_back(c);
+	}
+      };
+      for (Node s : srcs) {
+	const Component c = comps[s];
+	if (cyclic.test(c))
+	  visit(c);
+	for (const auto& [d, count] : succs[c])
+	  visit(d);
+      }
+      while (!todo.empty()) {
+	const Component c = todo.back();
+	todo.pop_back();
+	for (const auto& [d, count] : succs[c])
+	  visit(d);
+      }
+    }
+
+    // Whether there is a nonempty path from u to v.
+    bool reaches(Node u, Node v) const {
+      const Component cu = comps[u];
+      const Component cv = comps[v];
+      if (cu == cv)
+	return cyclic.test(cu);
+      if (cv > cu)
+	return false;
+      if (has_closure())
+	return closure[cu].test(cv);
+      llvm::BitVector mask;
+      reach(std::initializer_list<Node> {u}, mask);
+      return mask.test(cv);
+    }
+
+    /* Updates the index after the edge u->v has been cut from the graph. Cutting an edge between components only
+     * recomputes the closures of the components that could reach it; cutting an edge inside a component may split it,
+     * so that rebuilds the index.
+     */
+    void remove(Node u, Node v) {
+      const Component cu = comps[u];
+      const Component cv = comps[v];
+      if (cu == cv) {
+	build();
+	return;
+      }
+
+      auto it = succs[cu].find(cv);
+      assert(it != succs[cu].end());
+      if (--it->second > 0)
+	return;
+      succs[cu].erase(it);
+      preds[cv].erase(cu);
+      if (!has_closure())
+	return;
+
+      // Collect cu's ancestors, which are exactly the components whose closure may have shrunk.
+      llvm::BitVector dirty(components(), false);
+      std::stack<Component> todo;
+      dirty.set(cu);
+      todo.push(cu);
+      while (!todo.empty()) {
+	const Component c = todo.top();
+	todo.pop();
+	for (const auto& [p, count] : preds[c]) {
+	  if (!dirty.test(p)) {
+	    dirty.set(p);
+	    todo.push(p);
+	  }
+	}
+      }
+      for (Component c : dirty.set_bits())
+	compute_closure(c);
+    }
+
+  private:
+    const CSRGraph& G;
+    unsigned closure_limit;
+    std::vector<Component> comps;
+    std::vector<std::map<Component, unsigned>> succs; // number of live edges between components
+    std::vector<std::map<Component, unsigned>> preds;
+    llvm::BitVector cyclic; // components with a cycle, i.e., that reach themselves
+    std::vector<llvm::BitVector> closure;
+
+    bool has_closure() const { return !closure.empty(); }
+
+    // Successors' closures must already be up to date, which holds when going in increasing component order.
+    void compute_closure(Component c) {
+      llvm::BitVector& mask = closure[c];
+      mask.reset();
+      if (cyclic.test(c))
+	mask.set(c);
+      for (const auto& [d, count] : succs[c]) {
+	mask.set(d);
+	mask |= closure[d];
+      }
+    }
+
+    // Iterative Tarjan.
+    void build() {
+      const unsigned n = G.nodes();
+      constexpr unsigned none = -1;
+      comps.assign(n, none);
+      std::vector<unsigned> index(n, none), lowlink(n, 0);
+      llvm::BitVector on_stack(n, false);
+      std::vector<Node> stack;
+      std::vector<std::pair<Node, CSRGraph::node_iterator>> frames;
+      unsigned next_index = 0;
+      Component next_comp = 0;
+
+      for (Node root = 0; root < n; ++root) {
+	if (index[root] != none)
+	  continue;
+	const auto enter = [&] (Node u) {
+	  index[u] = lowlink[u] = next_index++;
+	  stack.push_back(u);
+	  on_stack.set(u);
+	  frames.emplace_back(u, G.succs(u).begin());
+	};
+	enter(root);
+	while (!frames.empty()) {
+	  auto& [u, it] = frames.back();
+	  if (it != G.succs(u).end()) {
+	    const Node v = *it++;
+	    if (index[v] == none)
+	      enter(v);
+	    else if (on_stack.test(v))
+	      lowlink[u] = std::min(lowlink[u], index[v]);
+	    continue;
+	  }
+
+	  const Node w = u;
+	  frames.pop_back();
+	  if (!frames.empty()) {
+	    const Node parent = frames.back().first;
+	    lowlink[parent] = std::min(lowlink[parent], lowlink[w]);
+	  }
+	  if (lowlink[w] == index[w]) {
+	    Node x;
+	    do {
+	      x = stack.back();
+	      stack.pop_back();
+	      on_stack.reset(x);
+	      comps[x] = next_comp;
+	    } while (x != w);
+	    ++next_comp;
+	  }
+	}
+      }
+
+      succs.assign(next_comp, {});
+      preds.assign(next_comp, {});
+      cyclic.clear();
+      cyclic.resize(next_comp, false);
+      for (Node u = 0; u < n; ++u) {
+	for (const Node v : G.succs(u)) {
+	  const Component cu = comps[u];
+	  const Component cv = comps[v];
+	  if (cu == cv) {
+	    cyclic.set(cu);
+	  } else {
+	    ++succs[cu][cv];
+	    ++preds[cv][cu];
+	  }
+	}
+      }
+
+      closure.clear();
+      if (next_comp <= closure_limit) {
+	closure.assign(next_comp, llvm::BitVector(next_comp, false));
+	for (Component c = 0; c < next_comp; ++c)
+	  compute_closure(c);
+      }
+    }
+  };
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <optional>
+#include <cassert>
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/iterator.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace clou {
+
+  /* Numbers a function's instructions densely, in program order, followed by its arguments, so that per-function sets
+   * and maps of them can be bitsets and vectors instead of pointer-keyed trees. Passes that require it share one
+   * numbering per function, which is only valid until the function is modified.
+   */
+  class DenseNumbering final: public llvm::FunctionPass {
+  public:
+    static char ID;
+    DenseNumbering();
+
+    unsigned size() const { return values.size(); }
+    unsigned numInstructions() const { return num_insts; }
+
+    bool contains(const llvm::Value *V) const { return ids.count(V); }
+    unsigned id(const llvm::Value *V) const {
+      const auto it = ids.find(V);
+      assert(it != ids.end() && "Value is not numbered!");
+      return it->second;
+    }
+    std::optional<unsigned> lookup(const llvm::Value *V) const {
+      const auto it = ids.find(V);
+      if (it == ids.end())
+	return std::nullopt;
+      return it->second;
+    }
+    llvm::Value *value(unsigned id) const { return values[id]; }
+    llvm::Instruction *instruction(unsigned id) const {
+      assert(id < num_insts);
+      return llvm::cast<llvm::Instruction>(values[id]);
+    }
+
+  private:
+    std::vector<llvm::Value *> values;
+    llvm::DenseMap<const llvm::Value *, unsigned> ids;
+    unsigned num_insts = 0;
+
+    void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
+    bool runOnFunction(llvm::Function& F) override;
+    void print(llvm::raw_ostream& os, const llvm::Module *M) const override;
+  };
+
+  /* A set of a function's numbered values, as a bitset over their DenseNumbering ids, with std::set's call-site
+   * interface. Iterates in numbering order (i.e., program order for instructions) rather than pointer order.
+   */
+  template <class T>
+  class NumberedSet {
+  public:
+    class iterator: public llvm::iterator_facade_base<iterator, std::forward_iterator_tag, T *, std::ptrdiff_t, T **, T *> {
+    public:
+      iterator() {}
+      iterator(const NumberedSet *set, int id): set(set), id(id) {}
+      T *operator*() const { return llvm::cast<T>(set->N->value(id)); }
+      iterator& operator++() { id = set->bits.find_next(id); return *this; }
+      iterator operator++(int) { iterator prev = *this; ++*this; return prev; }
+      bool operator==(const iterator& o) const { return id == o.id; }
+    private:
+      const NumberedSet *set = nullptr;
+      int id = -1; // -1 is the end
+    };
+    using const_iterator = iterator;
+    using value_type = T *;
+
+    explicit NumberedSet(const DenseNumbering& N): N(&N), bits(N.size()) {}
+
+    std::pair<iterator, bool> insert(T *x) {
+      const unsigned id = N->id(x);
+      const bool inserted = !bits.test(id);
+      bits.set(id);
+      return {iterator(this, id), inserted};
+    }
+    iterator insert(iterator, T *x) { return insert(x).first; }
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+      for (; first != last; ++first)
+	insert(*first);
+    }
+
+    bool contains(const T *x) const {
+      const auto id = N->lookup(x);
+      return id && bits.test(*id);
+    }
+    size_t count(const T *x) const { return contains(x) ? 1 : 0; }
+    size_t erase(const T *x) {
+      const auto id = N->lookup(x);
+      if (!id || !bits.test(*id))
+	return 0;
+      bits.reset(*id);
+      return 1;
+    }
+
+    size_t size() const { return bits.count(); }
+    bool empty() const { return bits.none(); }
+    void clear() { bits.reset(); }
+
+    iterator begin() const { return iterator(this, bits.find_first()); }
+    iterator end() const { return iterator(this, -1); }
+
+    NumberedSet& operator|=(const NumberedSet& o) { bits |= o.bits; return *this; }
+    NumberedSet& operator&=(const NumberedSet& o) { bits &= o.bits; return *this; }
+    bool operator==(const NumberedSet& o) const { return bits == o.bits; }
+    bool operator!=(const NumberedSet& o) const { return bits != o.bits; }
+
+  private:
+    const DenseNumbering *N;
+    llvm::BitVector bits;
+  };
+
+  using NumberedISet = NumberedSet<llvm::Instruction>;
+  using NumberedVSet = NumberedSet<llvm::Value>;
+
+}
@@ -2,8 +2,11 @@
 
 #include <set>
 #include <map>
+#include <vector>
 
 #include <llvm/IR/Value.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/BitVector.h>
 #include <llvm/Pass.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
@@ -18,14 +21,15 @@ namespace clou {
     NonspeculativeTaint();
     
   private:
-    std::set<llvm::Value *> pub_vals;
+    // The values of the function (instructions first, then arguments and other operands), numbered densely.
+    std::vector<llvm::Value *> values;
+    llvm::DenseMap<const llvm::Value *, unsigned> ids;
+    llvm::BitVector pub_vals;
     llvm::Function *F;
     
     void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
     bool runOnFunction(llvm::Function& F) override;
     void print(llvm::raw_ostream& os, const llvm::Module *M) const override;
-
-    void addAllOperands(llvm::User *U);
     
   public:
     bool secret(llvm::Value *V) const;
@@ -3,9 +3,14 @@
 #include <set>
 #include <queue>
 #include <map>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
 
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Instruction.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/STLExtras.h>
 
 namespace clou {
 
@@ -14,5 +19,74 @@ namespace clou {
   using VMap = std::map<llvm::Value *, VSet>;
   using ISet = std::set<llvm::Instruction *>;
   using IQueue = std::queue<llvm::Instruction *>;
+
+  /* A set kept as a sorted small vector, with std::set's call-site interface and iteration order, for the many small
+   * sets that don't need a heap-allocated tree node per element. Inserting one element is linear in the size, so build
+   * large sets from a range, which sorts once.
+   */
+  template <class T, unsigned N = 4, class Compare = std::less<T>>
+  class SortedVectorSet {
+  public:
+    using value_type = T;
+    using const_iterator = typename llvm::SmallVector<T, N>::const_iterator;
+    using iterator = const_iterator;
+    using size_type = size_t;
+
+    SortedVectorSet() {}
+    template <class InputIt>
+    SortedVectorSet(InputIt first, InputIt last): v(first, last) { normalize(); }
+    SortedVectorSet(std::initializer_list<T> il): SortedVectorSet(il.begin(), il.end()) {}
+
+    std::pair<iterator, bool> insert(const T& x) {
+      const size_t i = std::lower_bound(v.begin(), v.end(), x, Compare()) - v.begin();
+      if (i < v.size() && !Compare()(x, v[i]))
+	return {v.begin() + i, false};
+      v.insert(v.begin() + i, x);
+      return {v.begin() + i, true};
+    }
+    iterator insert(iterator, const T& x) { return insert(x).first; }
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+      v.append(first, last);
+      normalize();
+    }
+
+    iterator find(const T& x) const {
+      const auto it = std::lower_bound(v.begin(), v.end(), x, Compare());
+      return it != v.end() && !Compare()(x, *it) ? it : v.end();
+    }
+    bool contains(const T& x) const { return find(x) != end(); }
+    size_t count(const T& x) const { return contains(x) ? 1 : 0; }
+    size_t erase(const T& x) {
+      const auto it = find(x);
+      if (it == end())
+	return 0;
+      v.erase(v.begin() + (it - v.begin()));
+      return 1;
+    }
+
+    size_t size() const { return v.size(); }
+    bool empty() const { return v.empty(); }
+    void clear() { v.clear(); }
+    iterator begin() const { return v.begin(); }
+    iterator end() const { return v.end(); }
+
+    bool operator==(const SortedVectorSet& o) const { return v == o.v; }
+    bool operator!=(const SortedVectorSet& o) const { return v != o.v; }
+    bool operator<(const SortedVectorSet& o) const {
+      return std::lexicographical_compare(v.begin(), v.end(), o.v.begin(), o.v.end(), Compare());
+    }
+
+  private:
+    llvm::SmallVector<T, N> v;
+
+    void normalize() {
+      std::sort(v.begin(), v.end(), Compare());
+      v.erase(std::unique(v.begin(), v.end(), [] (const T& a, const T& b) { return !Compare()(a, b); }), v.end());
+    }
+  };
+
+  using SmallVSet = SortedVectorSet<llvm::Value *>;
+  using SmallISet = SortedVectorSet<llvm::Instruction *>;
   
 }
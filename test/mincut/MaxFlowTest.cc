@@ -0,0 +1,441 @@
+#ifdef NDEBUG
+# undef NDEBUG
+#endif
+
+#include <cassert>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <map>
+#include <set>
+#include <stack>
+#include <cmath>
+#include <sstream>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "clou/FordFulkerson.h"
+#include "clou/MinCutGreedy.h"
+#include "clou/ReachabilityIndex.h"
+#include "clou/Capacity.h"
+#include "clou/MinCutInstance.h"
+#include "clou/FenceProfile.h"
+#ifdef HAVE_Z3
+# include "clou/MinCutSMT.h"
+#endif
+
+namespace {
+
+  using Graph = std::vector<std::map<unsigned, unsigned>>;
+  using Cut = std::vector<std::pair<unsigned, unsigned>>;
+
+  Graph random_graph(std::mt19937& rng, unsigned n, unsigned degree, unsigned max_weight) {
+    Graph G(n);
+    std::uniform_int_distribution<unsigned> node(0, n - 1);
+    std::uniform_int_distribution<unsigned> weight(1, max_weight);
+    for (unsigned u = 0; u < n; ++u) {
+      // Keep a straight-line spine, like the instruction-level CFGs we cut.
+      if (u + 1 < n)
+	G[u][u + 1] = weight(rng);
+      for (unsigned i = 0; i < degree; ++i) {
+	const unsigned v = node(rng);
+	if (v != u)
+	  G[u][v] = weight(rng);
+      }
+    }
+    return G;
+  }
+
+  std::vector<std::set<unsigned>> random_waypoints(std::mt19937& rng, unsigned n, unsigned levels, unsigned size) {
+    std::vector<std::set<unsigned>> waypoints(levels);
+    std::uniform_int_distribution<unsigned> node(0, n - 1);
+    for (auto& waypoint_set : waypoints)
+      for (unsigned i = 0; i < size; ++i)
+	waypoint_set.insert(node(rng));
+    return waypoints;
+  }
+
+  uint64_t cut_weight(const Graph& G, const Cut& cut) {
+    uint64_t weight = 0;
+    for (const auto& [u, v] : cut)
+      weight += G[u].at(v);
+    return weight;
+  }
+
+  // Checks that no path visits the waypoint sets in order after removing the cut edges.
+  bool separates(const Graph& G, const Cut& cut, const std::vector<std::set<unsigned>>& waypoints) {
+    const std::set<std::pair<unsigned, unsigned>> cutset(cut.begin(), cut.end());
+    std::set<unsigned> S = waypoints.front();
+    for (const auto& T : llvm::ArrayRef(waypoints).drop_front()) {
+      llvm::BitVector reach(G.size(), false);
+      std::stack<unsigned> todo;
+      for (unsigned s : S)
+	todo.push(s);
+      while (!todo.empty()) {
+	const unsigned u = todo.top();
+	todo.pop();
+	for (const auto& [v, w] : G[u]) {
+	  if (reach.test(v) || cutset.contains({u, v}))
+	    continue;
+	  reach.set(v);
+	  todo.push(v);
+	}
+      }
+      S.clear();
+      for (unsigned t : T)
+	if (reach.test(t))
+	  S.insert(t);
+    }
+    return S.empty();
+  }
+
+  void check_instance(const Graph& G, const std::vector<std::set<unsigned>>& waypoints) {
+    const Cut ff = clou::ford_fulkerson_multi(G, waypoints, clou::MaxFlowAlgorithm::FordFulkerson);
+    const Cut dinic = clou::ford_fulkerson_multi(G, waypoints, clou::MaxFlowAlgorithm::Dinic);
+    assert(separates(G, ff, waypoints));
+    assert(separates(G, dinic, waypoints));
+    if (cut_weight(G, ff) != cut_weight(G, dinic)) {
+      llvm::errs() << "cut weight mismatch: ford-fulkerson " << cut_weight(G, ff) << ", dinic " << cut_weight(G, dinic) << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+    // Both compute the source-side minimal cut, so the edges themselves should agree too.
+    assert(ff == dinic);
+
+    // Masking the cut edges in the CSR graph must disconnect the instance, and restoring them must bring it back.
+    clou::CSRGraph CSR(G);
+    for (const auto& [u, v] : ff)
+      assert(CSR.remove(u, v));
+    assert(clou::ford_fulkerson_multi(CSR, waypoints).empty());
+    for (const auto& [u, v] : ff)
+      assert(CSR.restore(u, v));
+    assert(clou::ford_fulkerson_multi(CSR, waypoints) == ff);
+  }
+
+  // Randomly cuts and restores edges, checking that the warm-started solver always agrees with a cold solve.
+  void check_incremental(std::mt19937& rng, const Graph& G, const std::vector<std::set<unsigned>>& waypoints,
+			 clou::MaxFlowAlgorithm algorithm) {
+    clou::CSRGraph CSR(G);
+    std::vector<std::pair<unsigned, unsigned>> edges;
+    for (unsigned u = 0; u < G.size(); ++u)
+      for (const auto& [v, w] : G[u])
+	edges.emplace_back(u, v);
+    if (edges.empty())
+      return;
+    
+    clou::IncrementalMinCut inc(waypoints, algorithm);
+    for (unsigned round = 0; round < 20; ++round) {
+      const Cut cold = clou::ford_fulkerson_multi(CSR, waypoints, algorithm);
+      assert(inc.solve(CSR) == cold);
+
+      // Cut part of the current min cut (so that flow must be cancelled), plus some random edges, and restore some.
+      for (const auto& [u, v] : cold)
+	if (rng() % 2)
+	  CSR.remove(u, v);
+      for (unsigned i = 0; i < 3; ++i) {
+	const auto& [u, v] = edges[rng() % edges.size()];
+	if (rng() % 2)
+	  CSR.remove(u, v);
+	else
+	  CSR.restore(u, v);
+      }
+    }
+  }
+
+  // Checks the reachability index against a DFS, with and without closures, while cutting random edges.
+  void check_reachability(std::mt19937& rng, const Graph& G) {
+    clou::CSRGraph CSR(G);
+    clou::ReachabilityIndex closure(CSR, -1), walk(CSR, 0);
+    for (unsigned round = 0; round < 5; ++round) {
+      for (unsigned u = 0; u < G.size(); ++u) {
+	llvm::BitVector reach(G.size(), false);
+	std::stack<unsigned> todo;
+	todo.push(u);
+	while (!todo.empty()) {
+	  const unsigned v = todo.top();
+	  todo.pop();
+	  for (const unsigned w : CSR.succs(v)) {
+	    if (!reach.test(w)) {
+	      reach.set(w);
+	      todo.push(w);
+	    }
+	  }
+	}
+	for (unsigned v = 0; v < G.size(); ++v) {
+	  assert(closure.reaches(u, v) == reach.test(v));
+	  assert(walk.reaches(u, v) == reach.test(v));
+	}
+      }
+
+      for (unsigned i = 0; i < 3; ++i) {
+	const unsigned u = rng() % G.size();
+	if (G[u].empty())
+	  continue;
+	const unsigned v = std::next(G[u].begin(), rng() % G[u].size())->first;
+	if (CSR.remove(u, v)) {
+	  closure.remove(u, v);
+	  walk.remove(u, v);
+	}
+      }
+    }
+  }
+
+  void check_capacity() {
+    using clou::Capacity;
+    constexpr Capacity max = std::numeric_limits<Capacity>::max();
+    assert(clou::saturating_add<Capacity>(max - 1, 1) == max);
+    assert(clou::saturating_add<Capacity>(max - 1, 2) == max);
+    assert(clou::saturating_mul<Capacity>(Capacity(1) << 32, Capacity(1) << 32) == max);
+    assert(clou::saturating_mul<Capacity>(max, 0) == 0);
+    assert(clou::merge_capacities(clou::max_capacity, 1) == clou::max_capacity);
+    assert(clou::to_capacity(1.) == clou::capacity_scale);
+    assert(clou::to_capacity(0.) == 1 && clou::to_capacity(NAN) == 1);
+    assert(clou::to_capacity(INFINITY) == clou::max_capacity);
+    // Loop-depth scores stay ordered until they saturate, rather than wrapping around.
+    Capacity prev = 0;
+    for (unsigned depth = 0; depth < 64; ++depth) {
+      const Capacity w = clou::to_capacity(std::pow(depth + 1, 8.));
+      assert(w >= prev);
+      prev = w;
+    }
+    assert(prev == clou::max_capacity);
+  }
+
+  /* Checks that MinCutGreedy's cut, with sink culling and subsumption dropping STs before solving, still separates every
+   * ST it was given. STs share sources and overlap their sets, so that the dominance checks see s2 in T2 and t1 in S1.
+   */
+  void check_greedy(std::mt19937& rng, const Graph& G) {
+    const unsigned n = G.size();
+    std::vector<std::vector<std::set<unsigned>>> sts;
+    const unsigned count = 1 + rng() % 8;
+    for (unsigned i = 0; i < count; ++i) {
+      auto& st = sts.emplace_back(random_waypoints(rng, n, rng() % 4 ? 2 : 3, 1 + rng() % 3));
+      if (i > 0 && rng() % 2)
+	st.front() = sts[rng() % i].front();
+      if (rng() % 3 == 0)
+	st.back().insert(*st.front().begin());
+      if (rng() % 3 == 0)
+	st.front().insert(*st.back().begin());
+    }
+
+    clou::MinCutGreedy<unsigned> A;
+    for (unsigned u = 0; u < n; ++u) {
+      auto& dsts = A.G[u];
+      for (const auto& [v, w] : G[u])
+	dsts[v] = w;
+    }
+    for (const auto& st : sts)
+      A.add_st_list(st);
+    A.run();
+
+    Cut cut;
+    for (const auto& e : A.cut_edges)
+      cut.emplace_back(e.src, e.dst);
+    for (const auto& st : sts)
+      assert(separates(G, cut, st));
+  }
+
+#ifdef HAVE_Z3
+  /* The CEGAR backend must minimize full 64-bit capacities. Here, cutting 0->2 is cheapest if its weight is truncated to
+   * 32 bits, but 2->1 is the actual min cut. Random instances with weights above 2^32 must match the max flow.
+   */
+  void check_smt_wide_weights(std::mt19937& rng) {
+    using Alg = clou::MinCutSMT_CEGAR<unsigned, clou::Capacity>;
+    constexpr clou::Capacity wide = clou::Capacity(1) << 32;
+    {
+      Alg A;
+      A.G[0][2] = wide + 1;
+      A.G[2][1] = 2;
+      A.add_st({{0}, {1}});
+      A.run();
+      assert(A.optimal && A.optimal_weight == 2);
+      assert(A.cut_edges.size() == 1 && A.cut_edges.front().src == 2 && A.cut_edges.front().dst == 1);
+    }
+
+    for (unsigned i = 0; i < 20; ++i) {
+      const unsigned n = 2 + rng() % 12;
+      const Graph G = random_graph(rng, n, rng() % 3, 1000);
+      const auto waypoints = random_waypoints(rng, n, 2, 1 + rng() % 3);
+      std::vector<clou::CSRGraph::Edge> edges;
+      Alg A;
+      for (unsigned u = 0; u < n; ++u) {
+	for (const auto& [v, w] : G[u]) {
+	  const clou::Capacity wide_w = wide * w + rng() % wide;
+	  edges.push_back({.src = u, .dst = v, .w = wide_w});
+	  A.G[u][v] = wide_w;
+	}
+      }
+      A.add_st_list(waypoints);
+      A.run();
+      assert(A.optimal);
+
+      const clou::CSRGraph CSR(n, edges);
+      uint64_t flow = 0;
+      for (const auto& [u, v] : clou::ford_fulkerson_multi(CSR, waypoints))
+	flow += CSR.weight(CSR.at(u, v));
+      assert(A.optimal_weight == flow);
+    }
+  }
+#endif
+
+  // MinCutBench replays instances written by -clou-dump-min-cut, so they must read back exactly as written.
+  void check_instance_format(std::mt19937& rng) {
+    clou::MinCutInstance I;
+    I.name = "a function name with spaces";
+    I.nodes = 2 + rng() % 40;
+    const Graph G = random_graph(rng, I.nodes, 2, 1000);
+    for (unsigned u = 0; u < I.nodes; ++u)
+      for (const auto& [v, w] : G[u])
+	I.edges.push_back({.src = u, .dst = v, .w = (clou::Capacity(w) << 32) + rng()});
+    for (unsigned i = 0; i < 5; ++i)
+      I.sts.push_back(random_waypoints(rng, I.nodes, 2 + rng() % 3, 1 + rng() % 4));
+
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    I.write(os);
+    std::istringstream is(os.str());
+    const auto J = clou::MinCutInstance::read(is);
+    assert(J && J->name == I.name && J->nodes == I.nodes && J->sts == I.sts);
+    assert(J->edges.size() == I.edges.size());
+    for (size_t i = 0; i < I.edges.size(); ++i)
+      assert(J->edges[i].src == I.edges[i].src && J->edges[i].dst == I.edges[i].dst && J->edges[i].w == I.edges[i].w);
+
+    const auto malformed = [] (const std::string& s) {
+      std::istringstream is(s);
+      return !clou::MinCutInstance::read(is);
+    };
+    assert(malformed("clou-min-cut 2\nname f\nnodes 2\nedges 0\nsts 0\n"));
+    assert(malformed("clou-min-cut 1\nname f\nnodes 2\nedges 1\n0 2 1\nsts 0\n")); // edge to a missing node
+    assert(malformed("clou-min-cut 1\nname f\nnodes 2\nedges 1\n0 1 1\nsts 1\n2 1 0 1 5\n")); // ST node
+    assert(malformed("clou-min-cut 1\nname f\nnodes 2\nedges 2\n0 1 1\n")); // truncated
+    assert(!malformed("clou-min-cut 1\nname f\nnodes 2\nedges 1\n0 1 1\nsts 1\n2 1 0 1 1\n"));
+  }
+
+  void check_fence_profile() {
+    using clou::FenceProfile;
+    assert(FenceProfile::parse_key(FenceProfile::key("f", "a.c:1:2 @[ b.c:3:4 ]--->a.c:5:6")) ==
+	   FenceProfile::Site("f", "a.c:1:2 @[ b.c:3:4 ]--->a.c:5:6"));
+    assert(!FenceProfile::parse_key("no tab"));
+    assert(FenceProfile::has_locations("a.c:1:2--->a.c:3:4"));
+    assert(!FenceProfile::has_locations("--->"));
+    assert(!FenceProfile::has_locations("a.c:1:2--->"));
+    assert(!FenceProfile::has_locations("--->a.c:3:4"));
+    assert(!FenceProfile::has_locations("a.c:1:2"));
+
+    // Counts saturate rather than wrap.
+    constexpr uint64_t max = std::numeric_limits<uint64_t>::max();
+    FenceProfile P;
+    P.add({"f", "x--->y"}, max - 1);
+    P.add({"f", "x--->y"}, 5);
+    assert(P.counts.at({"f", "x--->y"}) == max);
+
+    // Reading merges into what is already there, including repeated sites within one input.
+    const auto read = [] (FenceProfile& P, const std::string& s) {
+      std::istringstream is(s);
+      return P.read(is);
+    };
+    FenceProfile Q;
+    assert(read(Q, "clou-fence-profile 1\n3\tf\tx--->y\n\n4\tf\tx--->y\n1\tg\tu v--->w\n"));
+    assert(read(Q, "clou-fence-profile 1\n10\tg\tu v--->w\n"));
+    assert(Q.counts.size() == 2 && Q.counts.at({"f", "x--->y"}) == 7 && Q.counts.at({"g", "u v--->w"}) == 11);
+
+    std::ostringstream os;
+    Q.write(os);
+    FenceProfile R;
+    assert(read(R, os.str()) && R.counts == Q.counts);
+
+    for (const char *s : {"", "clou-fence-profile 2\n", "clou-fence-profile 1\n5 f x--->y\n",
+			  "clou-fence-profile 1\n5x\tf\tx--->y\n", "clou-fence-profile 1\n-1\tf\tx--->y\n",
+			  "clou-fence-profile 1\n5\tf\n"}) {
+      FenceProfile S;
+      assert(!read(S, s));
+    }
+  }
+
+  /* A loop nest of the given depth, weighted like MitigatePass does with -clou-loop-weight=loop_weight:
+   *   pre -> h1 -> ... -> hD -> body -> {c1..ck} -> lD -> ... -> l1 -> exit, with back edges li -> hi.
+   * Edges in the innermost loops saturate for large depths and weights, and must still never look cheaper than the
+   * edges outside the nest.
+   */
+  void check_deep_loop(unsigned depth, double loop_weight, unsigned branches) {
+    const unsigned pre = 0, body = 2 * depth + 1, exit = 2 * depth + 2;
+    const auto header = [] (unsigned d) { return d; };
+    const auto latch = [depth] (unsigned d) { return 2 * depth + 1 - d; };
+    const auto branch = [depth] (unsigned i) { return 2 * depth + 3 + i; };
+    const auto weight = [loop_weight] (unsigned d) {
+      return clou::to_capacity(std::pow(d + 1, loop_weight));
+    };
+
+    std::vector<clou::CSRGraph::Edge> edges;
+    const auto edge = [&] (unsigned u, unsigned v, unsigned d) {
+      edges.push_back({.src = u, .dst = v, .w = weight(d)});
+    };
+    edge(pre, header(1), 0);
+    for (unsigned d = 1; d < depth; ++d)
+      edge(header(d), header(d + 1), d);
+    edge(header(depth), body, depth);
+    for (unsigned i = 0; i < branches; ++i) {
+      edge(body, branch(i), depth);
+      edge(branch(i), latch(depth), depth);
+    }
+    for (unsigned d = depth; d >= 1; --d) {
+      edge(latch(d), header(d), d);
+      edge(latch(d), d > 1 ? latch(d - 1) : exit, d - 1);
+    }
+    const clou::CSRGraph G(branch(branches), edges);
+
+    const auto check = [&] (const std::vector<std::set<unsigned>>& waypoints, const Cut& expected) {
+      for (const auto algorithm : {clou::MaxFlowAlgorithm::FordFulkerson, clou::MaxFlowAlgorithm::Dinic}) {
+	assert(clou::ford_fulkerson_multi(G, waypoints, algorithm) == expected);
+	clou::IncrementalMinCut inc(waypoints, algorithm);
+	assert(inc.solve(G) == expected);
+      }
+    };
+
+    // Leaving the innermost loop is cheapest outside the nest, on the way out...
+    check({{header(depth)}, {exit}}, {{latch(1), exit}});
+    // ... and entering it on the way in.
+    check({{pre}, {body}}, {{pre, header(1)}});
+    // Going around the innermost loop must cut all of its branches, each of which may be saturated; the total must not
+    // wrap around.
+    Cut branch_cut;
+    for (unsigned i = 0; i < branches; ++i)
+      branch_cut.emplace_back(body, branch(i));
+    check({{body}, {latch(depth)}}, branch_cut);
+  }
+  
+}
+
+int main() {
+  check_capacity();
+  check_fence_profile();
+  for (const unsigned depth : {1, 4, 12, 24})
+    for (const double loop_weight : {1., 4., 16.})
+      check_deep_loop(depth, loop_weight, 1 + depth % 5);
+
+  std::mt19937 rng(0);
+  for (unsigned i = 0; i < 20; ++i)
+    check_instance_format(rng);
+#ifdef HAVE_Z3
+  check_smt_wide_weights(rng);
+#endif
+
+  for (unsigned i = 0; i < 500; ++i) {
+    const unsigned n = 2 + rng() % 60;
+    const Graph G = random_graph(rng, n, rng() % 3, 1 + rng() % 1000);
+    const auto waypoints = random_waypoints(rng, n, 2 + rng() % 3, 1 + rng() % 4);
+    check_instance(G, waypoints);
+    check_incremental(rng, G, waypoints, clou::MaxFlowAlgorithm::FordFulkerson);
+    check_incremental(rng, G, waypoints, clou::MaxFlowAlgorithm::Dinic);
+    check_reachability(rng, G);
+    check_greedy(rng, G);
+  }
+
+  // Larger, sparser instances.
+  for (unsigned i = 0; i < 20; ++i) {
+    const unsigned n = 1000 + rng() % 2000;
+    const Graph G = random_graph(rng, n, 1, 1000);
+    const auto waypoints = random_waypoints(rng, n, 2 + rng() % 2, 1 + rng() % 16);
+    check_instance(G, waypoints);
+  }
+}
@@ -1,10 +1,18 @@
 #include <libunwind.h>
 #include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
 #include <string>
 #include <map>
 #include <cstdint>
+#include <fstream>
+
+#include "clou/FenceProfile.h"
 
 #define UNW_CHK(name, res)					\
   do {								\
@@ -19,13 +27,91 @@ namespace {
   static FILE *log = stderr;
 
   struct Trace {
-    std::map<const char *, unsigned> lfences;
+    std::map<const char *, uint64_t> lfences;
     ~Trace() {
-      std::map<std::string, unsigned> counts;
+      std::map<std::string, uint64_t> counts;
       for (const auto& [s, n] : lfences)
 	counts[s] += n;
-      for (const auto& [s, n] : counts)
-	std::fprintf(log, "%u %s\n", n, s.c_str());
+
+      // With CLOU_FENCE_PROFILE=<file>, merge the counts into a profile for -clou-fence-profile instead.
+      if (const char *path = std::getenv("CLOU_FENCE_PROFILE")) {
+	write_profile(path, counts);
+	return;
+      }
+      
+      // Otherwise print each site's description, as before sites were keyed by function too.
+      std::map<std::string, uint64_t> descriptions;
+      for (const auto& [s, n] : counts) {
+	const auto site = clou::FenceProfile::parse_key(s);
+	descriptions[site ? site->second : s] += n;
+      }
+      for (const auto& [s, n] : descriptions)
+	std::fprintf(log, "%llu %s\n", static_cast<unsigned long long>(n), s.c_str());
+    }
+
+    /* Concurrent runs may exit at the same time, so hold an exclusive lock on the profile across the whole
+     * read-merge-write, and write to a temporary file that is renamed into place, so that no reader ever sees a partial
+     * profile. This runs during exit(), so errors are only warnings: calling exit() again from here is undefined.
+     */
+    static void write_profile(const char *path, const std::map<std::string, uint64_t>& counts) {
+      const int fd = lock_profile(path);
+      if (fd < 0)
+	return;
+      merge_profile(path, counts);
+      ::close(fd);
+    }
+
+    /* The lock is on the old inode, which the rename replaces, so a run that was waiting on it checks that it still
+     * locked the current profile and otherwise tries again. Returns -1 on failure.
+     */
+    static int lock_profile(const char *path) {
+      while (true) {
+	const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+	  warn("open: %s", path);
+	  return -1;
+	}
+	struct stat locked, current;
+	if (::flock(fd, LOCK_EX) < 0 || ::fstat(fd, &locked) < 0) {
+	  warn("flock: %s", path);
+	  ::close(fd);
+	  return -1;
+	}
+	if (::stat(path, &current) == 0 && current.st_dev == locked.st_dev && current.st_ino == locked.st_ino)
+	  return fd;
+	::close(fd);
+      }
+    }
+
+    static void merge_profile(const char *path, const std::map<std::string, uint64_t>& counts) {
+      clou::FenceProfile profile;
+      if (std::ifstream is(path); is.peek() != std::ifstream::traits_type::eof() && !profile.read(is)) {
+	warnx("%s: malformed fence profile; not saving this run's counts", path);
+	return;
+      }
+      for (const auto& [s, n] : counts) {
+	if (const auto site = clou::FenceProfile::parse_key(s)) {
+	  if (clou::FenceProfile::has_locations(site->second))
+	    profile.add(*site, n);
+	} else {
+	  warnx("%s: fence not built with a profile key: %s", path, s.c_str());
+	}
+      }
+
+      const std::string tmp_path = std::string(path) + "." + std::to_string(::getpid()) + ".tmp";
+      {
+	std::ofstream os(tmp_path);
+	profile.write(os);
+	if (!os.flush()) {
+	  warnx("%s: failed to write fence profile", tmp_path.c_str());
+	  std::remove(tmp_path.c_str());
+	  return;
+	}
+      }
+      if (std::rename(tmp_path.c_str(), path) < 0) {
+	warn("rename: %s", path);
+	std::remove(tmp_path.c_str());
+      }
     }
     
   } trace;